@@ -0,0 +1,50 @@
+/* Heap string allocations per second through the default pool and
+ * through plain malloc, on 1 and 4 threads. Each round builds 1000
+ * strings of 16 to 256 bytes and drops them.
+ *
+ * "build.bat bench" builds every benchmark; elsewhere, compile one
+ * together with the .cpp files in src (with -O2 and threads). */
+#include "../src/string.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+static const int ROUNDS = 2000;
+static const int STRINGS = 1000;
+
+static double allocsPerSec(int threads) {
+    static char src[300];
+    memset(src, 'x', sizeof(src));
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; t++) {
+        ts.emplace_back([] {
+            std::vector<string> v;
+            v.reserve(STRINGS);
+            for (int r = 0; r < ROUNDS; r++) {
+                for (int i = 0; i < STRINGS; i++) {
+                    v.push_back(string(src, 16 + (i * 37) % 241));
+                }
+                v.clear();
+            }
+        });
+    }
+    for (std::thread& t : ts) {
+        t.join();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return (double)threads * ROUNDS * STRINGS / secs;
+}
+
+int main() {
+    for (int threads : {1, 4}) {
+        // no heap string is alive between runs, so switching is allowed
+        string::setAllocator(string::mallocAllocator());
+        double m = allocsPerSec(threads);
+        string::setAllocator(string::poolAllocator());
+        double p = allocsPerSec(threads);
+        printf("%d thread(s): malloc %.1fM allocs/s, pool %.1fM allocs/s (%.2fx)\n",
+            threads, m / 1e6, p / 1e6, p / m);
+    }
+}
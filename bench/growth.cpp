@@ -0,0 +1,71 @@
+/* The suite behind the GrowthPolicy defaults: strings built from
+ * empty by 256-byte appends, to 1 KB up to 1 GB, under several
+ * policies. "pow2" never leaves the power-of-two path, as before
+ * growLarge(). Peak is the most heap the strings held at once, counted
+ * by wrapping the pool allocator. An optional argument caps the size,
+ * e.g. "growth 16777216". */
+#include "../src/string.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+static string_base::Allocator pool = string_base::poolAllocator();
+static uint64_t live, peak;
+
+static void* trackAllocate(size_t size) {
+    live += size;
+    peak = live > peak ? live : peak;
+    return pool.allocate(size);
+}
+static void* trackReallocate(void* ptr, size_t old_size, size_t new_size) {
+    live += new_size - old_size;
+    peak = live > peak ? live : peak;
+    return pool.reallocate(ptr, old_size, new_size);
+}
+static void trackDeallocate(void* ptr, size_t size) {
+    live -= size;
+    pool.deallocate(ptr, size);
+}
+
+struct Policy {
+    const char* name;
+    string_base::GrowthPolicy growth;
+};
+
+int main(int argc, char** argv) {
+    uint64_t max_len = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1 << 30;
+    string_base::setAllocator({trackAllocate, trackReallocate, trackDeallocate});
+    const Policy policies[] = {
+        {"1.5, 64 KB", {1.5, 64 << 10}},
+        {"1.5, 1 MB", {1.5, 1 << 20}},
+        {"1.5, 16 MB", {1.5, 16 << 20}},
+        {"2, 64 KB", {2, 64 << 10}},
+        {"2, 1 MB", {2, 1 << 20}},
+        {"2, 16 MB", {2, 16 << 20}},
+        {"pow2", {2, UINT64_MAX}},
+    };
+    char chunk[256];
+    for (int i = 0; i < 256; i++) {
+        chunk[i] = 'a' + i % 26;
+    }
+    string piece(chunk, 256);
+    for (uint64_t len = 1 << 10; len <= max_len; len *= 16) {
+        for (const Policy& p : policies) {
+            string_base::setGrowthPolicy(p.growth);
+            // about 256 MB of appends per row, so small sizes aren't lost in the noise
+            uint64_t reps = len >= (256 << 20) ? 1 : (256 << 20) / len;
+            reps = reps > 20000 ? 20000 : reps;
+            uint64_t base = peak = live;
+            auto t0 = std::chrono::steady_clock::now();
+            for (uint64_t r = 0; r < reps; r++) {
+                string s;
+                while (s.length() < len) {
+                    s += piece;
+                }
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / reps;
+            printf("%10llu B  %-11s %10.4f ms  %6.2f GB/s  peak %7.1f MB\n", (unsigned long long)len,
+                p.name, ms, len / ms / 1e6, (peak - base) / 1e6);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/* Copy and destroy throughput of heap strings on 1 to N threads, N
+ * being the core count. Each thread copies a string it built itself
+ * (the owner's non-atomic count), a string main built (the shared
+ * atomic count), and, for comparison, a handle that counts the way
+ * every string did before biased counting: one atomic in the header,
+ * shared by all threads. */
+#include "../src/string.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+static const int COPIES = 20000000;
+
+// incref and decref as they were: an atomic add and subtract
+struct AtomicCounted {
+    std::atomic<uint32_t>* refc;
+    AtomicCounted() : refc(nullptr) {}
+    AtomicCounted(const AtomicCounted& other) : refc(other.refc) {
+        refc->fetch_add(1, std::memory_order_relaxed);
+    }
+    AtomicCounted& operator=(const AtomicCounted& other) {
+        other.refc->fetch_add(1, std::memory_order_relaxed);
+        release();
+        refc = other.refc;
+        return *this;
+    }
+    ~AtomicCounted() {
+        release();
+    }
+    void release() {
+        // the benchmark's own reference keeps the count above zero
+        if (refc) {
+            refc->fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+};
+
+template<typename T, typename F> static double copiesPerSec(int threads, F source) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; t++) {
+        ts.emplace_back([&] {
+            T src = source();
+            T slots[8];
+            for (int i = 0; i < COPIES / threads; i++) {
+                slots[i & 7] = src;
+            }
+        });
+    }
+    for (std::thread& t : ts) {
+        t.join();
+    }
+    return COPIES / std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main() {
+    string shared = string("a configuration value built at startup") + 1;
+    std::atomic<uint32_t> old_count(1);
+    AtomicCounted old_shared;
+    old_shared.refc = &old_count;
+    int cores = std::thread::hardware_concurrency();
+    std::vector<int> counts;
+    for (int threads = 1; threads < cores; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(cores > 1 ? cores : 1);
+    for (int threads : counts) {
+        double own = copiesPerSec<string>(threads, [] {
+            return string("a string built on this worker thread") + 2;
+        });
+        double other = copiesPerSec<string>(threads, [&] { return shared; });
+        double old = copiesPerSec<AtomicCounted>(threads, [&] { return old_shared; });
+        printf("%2d thread(s): own string %6.1fM copies/s, main's string %6.1fM/s, one atomic count %6.1fM/s\n",
+            threads, own / 1e6, other / 1e6, old / 1e6);
+    }
+}
@@ -0,0 +1,56 @@
+/* Byte scan throughput at every scan level the CPU supports, on
+ * haystacks of 1 KB to 1 GB: countOf('\n') over text with a newline
+ * every 64 bytes, and indexOf/lastIndexOf of a byte that isn't there,
+ * so each call reads the whole haystack. An optional argument caps
+ * the size. */
+#include "../src/string.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static const char* const LEVELS[] = {"portable", "sse2", "avx2", "avx512"};
+static volatile uint64_t sink;
+
+// best of three, each repeated over about 1 GB
+template<typename F> static double gbPerSec(uint64_t len, F scan) {
+    uint64_t reps = (1 << 30) / len;
+    reps = reps < 1 ? 1 : reps > 1000000 ? 1000000 : reps;
+    double best = 1e30;
+    for (int t = 0; t < 3; t++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (uint64_t r = 0; r < reps; r++) {
+            sink += scan();
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / reps;
+        best = ns < best ? ns : best;
+    }
+    return len / best;
+}
+
+int main(int argc, char** argv) {
+    uint64_t max_len = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1 << 30;
+    std::vector<char> raw;
+    raw.reserve(max_len + string_base::ADOPT_SLACK);
+    for (uint64_t i = 0; i < max_len; i++) {
+        raw.push_back(i % 64 == 63 ? '\n' : 'a' + i * 7 % 26);
+    }
+    string text = string::adopt(std::move(raw));
+    int top = string_base::setScanLevel(string_base::SCAN_AVX512);
+    std::vector<uint64_t> lens;
+    for (uint64_t len = 1 << 10; len < max_len; len *= 8) {
+        lens.push_back(len);
+    }
+    lens.push_back(max_len);
+    printf("%10s  %-8s  %6s  %7s  %11s  (GB/s)\n", "bytes", "level", "countOf", "indexOf", "lastIndexOf");
+    for (uint64_t len : lens) {
+        string s = text.substring(0, len);
+        for (int level = string_base::SCAN_PORTABLE; level <= top; level++) {
+            string_base::setScanLevel((string_base::ScanLevel)level);
+            double count = gbPerSec(len, [&] { return s.countOf('\n'); });
+            double find = gbPerSec(len, [&] { return (uint64_t)s.indexOf('#'); });
+            double rfind = gbPerSec(len, [&] { return (uint64_t)s.lastIndexOf('#'); });
+            printf("%10llu  %-8s  %7.2f  %7.2f  %11.2f\n", (unsigned long long)len, LEVELS[level], count, find, rfind);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/* Heap allocations and bytes for a million keys of the kinds that sit
+ * just past string's 15 inline bytes, stored in each flavor: 30% short
+ * ids, 20% ISO timestamps, 25% UUIDs, 15% IPv6 addresses and 10% paths.
+ * This is the mix that sized sso24_string and sso32_string. */
+#include "../src/string.hpp"
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+static uint64_t allocations, bytes;
+static string_base::Allocator plain = string_base::mallocAllocator();
+
+static void* countingAllocate(size_t size) {
+    allocations++;
+    bytes += size;
+    return plain.allocate(size);
+}
+static void* countingReallocate(void* ptr, size_t old_size, size_t new_size) {
+    allocations++;
+    bytes += new_size - old_size;
+    return plain.reallocate(ptr, old_size, new_size);
+}
+
+static std::vector<std::string> keys() {
+    std::mt19937 r(42);
+    const char* hex = "0123456789abcdef";
+    std::vector<std::string> v;
+    for (int i = 0; i < 1000000; i++) {
+        int kind = r() % 100;
+        std::string s;
+        if (kind < 30) {
+            int n = 4 + r() % 9;
+            for (int j = 0; j < n; j++) {
+                s += 'a' + r() % 26;
+            }
+        } else if (kind < 50) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "2026-10-%02uT%02u:%02u:%02u.%03uZ",
+                (unsigned)(1 + r() % 28), (unsigned)(r() % 24), (unsigned)(r() % 60),
+                (unsigned)(r() % 60), (unsigned)(r() % 1000));
+            s = buf;
+        } else if (kind < 75) {
+            for (int j = 0; j < 36; j++) {
+                s += (j == 8 || j == 13 || j == 18 || j == 23) ? '-' : hex[r() % 16];
+            }
+        } else if (kind < 90) {
+            int groups = 3 + r() % 6;
+            for (int j = 0; j < groups; j++) {
+                s += j ? ":" : "";
+                for (int n = 1 + r() % 4; n > 0; n--) {
+                    s += hex[r() % 16];
+                }
+            }
+        } else {
+            int n = 20 + r() % 61;
+            s = "/var/lib/";
+            while ((int)s.size() < n) {
+                s += 'a' + r() % 26;
+            }
+        }
+        v.push_back(s);
+    }
+    return v;
+}
+
+template<typename S> static void store(const char* name, const std::vector<std::string>& keys) {
+    allocations = bytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        std::vector<S> v;
+        v.reserve(keys.size());
+        for (const std::string& k : keys) {
+            v.push_back(S(k.data(), (typename S::ssize_type)k.size()));
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    printf("%-13s %2zu B object  %7llu allocations  %5.1f MB  %4.0f ms\n", name, sizeof(S),
+        (unsigned long long)allocations, bytes / 1e6, ms);
+}
+
+int main() {
+    string_base::setAllocator({countingAllocate, countingReallocate, plain.deallocate});
+    std::vector<std::string> k = keys();
+    store<string>("string", k);
+    store<string64>("string64", k);
+    store<sso24_string>("sso24_string", k);
+    store<sso32_string>("sso32_string", k);
+}
@@ -3,4 +3,8 @@ cd target
 clang++ -c -Wall -O3 ../src/*.cpp
 llvm-ar rc string.a *.o
 del *.o
-cd ..
\ No newline at end of file
+REM "build.bat bench" also builds each bench\*.cpp into target\bench_*.exe
+if "%1"=="bench" (
+    for %%f in (..\bench\*.cpp) do clang++ -Wall -O3 %%f string.a -o bench_%%~nf.exe
+)
+cd ..
@@ -0,0 +1,282 @@
+#include "string.hpp"
+#include <stdlib.h>
+#include <mutex>
+
+typedef uint32_t u32;
+
+/* Size-class pool for string allocations.
+ *
+ * Every class is a power of two between POOL_MIN and POOL_MAX bytes.
+ * Blocks are obtained from malloc() one at a time, exactly class-sized,
+ * so a block is not tied to the thread that created it: whichever thread
+ * frees it simply caches it. That is the cross-thread return path.
+ *
+ * To keep producer/consumer threads (one builds strings, another drops
+ * them) from hoarding memory, each thread cache is bounded. When it
+ * overflows, half of it is moved to a global depot, from which other
+ * threads refill in batches. Whatever does not fit in the depot goes
+ * back to free(). A thread that exits hands its cache to the depot.
+ *
+ * Larger blocks are only cached when their size is a power of two up
+ * to RECYCLE_MAX: those are the buffers appends grow into
+ * (allocVectorWithFooter), and a loop that builds and drops strings
+ * cycles through the same few of them. Each thread keeps up to
+ * RECYCLE_COUNT blocks per size and RECYCLE_BYTES in all, with no
+ * depot; the rest, and a thread's blocks when it exits, are freed.
+ */
+
+#define POOL_MIN_SHIFT 5
+#define POOL_MAX_SHIFT 9
+#define POOL_MIN (1u << POOL_MIN_SHIFT)
+#define POOL_MAX (1u << POOL_MAX_SHIFT)
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define CACHE_MAX 64
+#define CACHE_BATCH (CACHE_MAX / 2)
+#define DEPOT_MAX 4096
+#define RECYCLE_MAX_SHIFT 20
+#define RECYCLE_MAX (1u << RECYCLE_MAX_SHIFT)
+#define RECYCLE_CLASSES (RECYCLE_MAX_SHIFT - POOL_MAX_SHIFT)
+#define RECYCLE_COUNT 4
+#define RECYCLE_BYTES (2u << 20)
+
+struct Block {
+    Block* next;
+};
+
+struct ThreadCache {
+    Block* head[POOL_CLASSES];
+    u32 count[POOL_CLASSES];
+    Block* recycled[RECYCLE_CLASSES];
+    u32 recycled_count[RECYCLE_CLASSES];
+    size_t recycled_bytes;
+    bool registered;
+    bool dead;
+};
+
+struct Depot {
+    std::mutex lock;
+    Block* head;
+    u32 count;
+};
+
+static thread_local ThreadCache cache;
+static Depot depot[POOL_CLASSES];
+
+// size must be <= POOL_MAX
+static u32 classOf(u32 size) {
+    u32 cls = 0;
+    u32 class_size = POOL_MIN;
+    while (class_size < size) {
+        class_size <<= 1;
+        cls++;
+    }
+    return cls;
+}
+static u32 classSize(u32 cls) {
+    return POOL_MIN << cls;
+}
+// The recycling class of a block of this size, or -1 if it has none.
+static int recycleClassOf(size_t size) {
+    if (size <= POOL_MAX || size > RECYCLE_MAX || (size & (size - 1))) {
+        return -1;
+    }
+    int cls = 0;
+    size_t class_size = POOL_MAX << 1;
+    while (class_size < size) {
+        class_size <<= 1;
+        cls++;
+    }
+    return cls;
+}
+
+static void depotPut(u32 cls, Block* first, Block* last, u32 n) {
+    Depot& d = depot[cls];
+    {
+        std::lock_guard<std::mutex> guard(d.lock);
+        if (d.count + n <= DEPOT_MAX) {
+            last->next = d.head;
+            d.head = first;
+            d.count += n;
+            return;
+        }
+    }
+    while (n--) {
+        Block* next = first->next;
+        free(first);
+        first = next;
+    }
+}
+static u32 depotTake(u32 cls, u32 n) {
+    Depot& d = depot[cls];
+    std::lock_guard<std::mutex> guard(d.lock);
+    u32 taken = 0;
+    while (taken < n && d.head) {
+        Block* block = d.head;
+        d.head = block->next;
+        block->next = cache.head[cls];
+        cache.head[cls] = block;
+        taken++;
+    }
+    d.count -= taken;
+    return taken;
+}
+// moves the first n blocks of a thread cache list into the depot
+static void spill(u32 cls, u32 n) {
+    Block* first = cache.head[cls];
+    Block* last = first;
+    for (u32 i = 1; i < n; i++) {
+        last = last->next;
+    }
+    cache.head[cls] = last->next;
+    last->next = nullptr;
+    cache.count[cls] -= n;
+    depotPut(cls, first, last, n);
+}
+
+struct Flusher {
+    ~Flusher() {
+        for (u32 cls = 0; cls < POOL_CLASSES; cls++) {
+            if (cache.count[cls]) {
+                spill(cls, cache.count[cls]);
+            }
+        }
+        for (u32 cls = 0; cls < RECYCLE_CLASSES; cls++) {
+            while (Block* block = cache.recycled[cls]) {
+                cache.recycled[cls] = block->next;
+                free(block);
+            }
+            cache.recycled_count[cls] = 0;
+        }
+        cache.recycled_bytes = 0;
+        /* Strings held by other thread_locals may still be
+         * destroyed after this point; their blocks go
+         * straight to the depot. */
+        cache.dead = true;
+    }
+};
+static thread_local Flusher flusher;
+
+static void registerFlusher() {
+    if (!cache.registered) {
+        cache.registered = true;
+        (void)&flusher;
+    }
+}
+
+static void* recycledAllocate(size_t size) {
+    int cls = recycleClassOf(size);
+    if (cls < 0 || !cache.recycled[cls]) {
+        return malloc(size);
+    }
+    Block* block = cache.recycled[cls];
+    cache.recycled[cls] = block->next;
+    cache.recycled_count[cls]--;
+    cache.recycled_bytes -= size;
+    return block;
+}
+static void recycledDeallocate(void* ptr, size_t size) {
+    int cls = recycleClassOf(size);
+    if (cls < 0 || cache.dead
+    || cache.recycled_count[cls] == RECYCLE_COUNT
+    || cache.recycled_bytes + size > RECYCLE_BYTES) {
+        free(ptr);
+        return;
+    }
+    registerFlusher();
+    Block* block = (Block*)ptr;
+    block->next = cache.recycled[cls];
+    cache.recycled[cls] = block;
+    cache.recycled_count[cls]++;
+    cache.recycled_bytes += size;
+}
+
+static void* poolAllocate(size_t size) {
+    if (size > POOL_MAX) {
+        return recycledAllocate(size);
+    }
+    u32 cls = classOf((u32)size);
+    Block* block = cache.head[cls];
+    if (block) {
+        cache.head[cls] = block->next;
+        cache.count[cls]--;
+        return block;
+    }
+    u32 taken = cache.dead ? 0 : depotTake(cls, CACHE_BATCH);
+    if (taken) {
+        registerFlusher();
+        block = cache.head[cls];
+        cache.head[cls] = block->next;
+        cache.count[cls] += taken - 1;
+        return block;
+    }
+    return malloc(classSize(cls));
+}
+static void poolDeallocate(void* ptr, size_t size) {
+    if (size > POOL_MAX) {
+        recycledDeallocate(ptr, size);
+        return;
+    }
+    u32 cls = classOf((u32)size);
+    Block* block = (Block*)ptr;
+    if (cache.dead) {
+        depotPut(cls, block, block, 1);
+        return;
+    }
+    registerFlusher();
+    block->next = cache.head[cls];
+    cache.head[cls] = block;
+    if (++cache.count[cls] > CACHE_MAX) {
+        spill(cls, CACHE_BATCH);
+    }
+}
+static void* poolReallocate(void* ptr, size_t old_size, size_t new_size) {
+    bool old_pooled = old_size <= POOL_MAX;
+    bool new_pooled = new_size <= POOL_MAX;
+    // recycled blocks came from malloc() too
+    if (!old_pooled && !new_pooled) {
+        return realloc(ptr, new_size);
+    }
+    if (old_pooled && new_pooled
+    && classOf((u32)old_size) == classOf((u32)new_size)) {
+        return ptr;
+    }
+    void* res = poolAllocate(new_size);
+    memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+    poolDeallocate(ptr, old_size);
+    return res;
+}
+
+static void* mallocAllocate(size_t size) {
+    return malloc(size);
+}
+static void mallocDeallocate(void* ptr, size_t) {
+    free(ptr);
+}
+static void* mallocReallocate(void* ptr, size_t, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+string_base::Allocator string_base::mallocAllocator() {
+    return Allocator{
+        mallocAllocate, mallocReallocate, mallocDeallocate
+    };
+}
+string_base::Allocator string_base::poolAllocator() {
+    return Allocator{
+        poolAllocate, poolReallocate, poolDeallocate
+    };
+}
+
+/* Constant-initialized, so strings built by static
+ * constructors in other files already see it. */
+string_base::Allocator string_base::allocator = {
+#ifdef STRING_NO_POOL
+    mallocAllocate, mallocReallocate, mallocDeallocate
+#else
+    poolAllocate, poolReallocate, poolDeallocate
+#endif
+};
+
+void string_base::setAllocator(const Allocator& a) {
+    allocator = a;
+}
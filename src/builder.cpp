@@ -0,0 +1,100 @@
+#include "string.hpp"
+
+template<typename Traits>
+basic_string_builder<Traits>::basic_string_builder(basic_string_builder&& other)
+    : buf(std::move(other.buf)),
+    start(other.start), tail(other.tail), end(other.end) {
+    other.start = other.tail = other.end = nullptr;
+}
+template<typename Traits>
+basic_string_builder<Traits>& basic_string_builder<Traits>::operator=(basic_string_builder&& other) {
+    if (this != &other) {
+        buf = std::move(other.buf);
+        start = other.start;
+        tail = other.tail;
+        end = other.end;
+        other.start = other.tail = other.end = nullptr;
+    }
+    return *this;
+}
+
+/* The buffer is always on the heap, even when the result would fit
+ * in SSO, so that start/tail/end survive moving the builder. build()
+ * moves short results into SSO. Until then buf's length is its whole
+ * capacity, so a barely used buffer never looks pinned (see
+ * pinStats()) when it is dropped, and a full one grows like any
+ * string, with realloc() once it is large. */
+template<typename Traits>
+void basic_string_builder<Traits>::grow(size_type more) {
+    size_type len = length();
+    if (start) {
+        buf.ensureSpaceFor(len + more - buf.alloc.len);
+    } else {
+        size_type sso_cap = sizeof(buf.alloc) - 1;
+        buf.ensureSpaceFor(more > sso_cap ? more : sso_cap + 1);
+    }
+    buf.alloc.len = buf.getAllocCap();
+    start = buf.alloc.data;
+    tail = start + len;
+    end = start + buf.getAllocCap();
+}
+
+template<typename Traits>
+void basic_string_builder<Traits>::reserve(size_type cap) {
+    if (cap <= capacity()) {
+        return;
+    }
+    if (length() == 0 && cap >= sizeof(buf.alloc)) {
+        // Exactly cap, where growing would round up to a power of two.
+        buf = basic_string<Traits>((typename basic_string<Traits>::ssize_type)cap);
+        start = tail = buf.alloc.data;
+        end = start + cap;
+    } else {
+        grow(cap - length());
+    }
+}
+
+/* The buffer moves into the result. Unused room is only given back
+ * if it is more than a quarter of the length, since shrinking a
+ * pooled block means copying it. */
+template<typename Traits>
+basic_string<Traits> basic_string_builder<Traits>::build() {
+    if (!start) {
+        return basic_string<Traits>();
+    }
+    size_type len = length();
+    *tail = '\0';
+    buf.alloc.len = len;
+    basic_string<Traits> res = std::move(buf);
+    start = tail = end = nullptr;
+    if (res.getAllocCap() - len > len / 4) {
+        res.shrinkNonSubstringToFitLength(len);
+    }
+    return res;
+}
+
+template<typename Traits>
+basic_string_builder<Traits>& basic_string_builder<Traits>::append(int64_t val) {
+    tail += i2s(writableTail(I2S_BUFLEN), val);
+    return *this;
+}
+template<typename Traits>
+basic_string_builder<Traits>& basic_string_builder<Traits>::append(uint64_t val) {
+    tail += u2s(writableTail(U2S_BUFLEN), val);
+    return *this;
+}
+template<typename Traits>
+basic_string_builder<Traits>& basic_string_builder<Traits>::append(double val) {
+    tail += d2s(writableTail(D2S_BUFLEN), val);
+    return *this;
+}
+template<typename Traits>
+basic_string_builder<Traits>& basic_string_builder<Traits>::append(char32_t cp) {
+    tail += cp2utf8(writableTail(4), cp);
+    return *this;
+}
+
+template class basic_string_builder<string_traits>;
+template class basic_string_builder<string64_traits>;
+template class basic_string_builder<sso_string_traits<24>>;
+template class basic_string_builder<sso_string_traits<32>>;
@@ -1,8 +1,8 @@
 #include "string.hpp"
 
-typedef uint32_t u32;
+typedef uint64_t u64;
 
-inline static u32 min(u32 a, u32 b) {
+inline static u64 min(u64 a, u64 b) {
     if (a < b) {
         return a;
     }
@@ -10,8 +10,9 @@ inline static u32 min(u32 a, u32 b) {
     return b;
 }
 
-int string::compareInternal(const char* other, u32 other_slen) const {
-    u32 slen = length();
+template<typename Traits>
+int basic_string<Traits>::compareInternal(const char* other, size_type other_slen) const {
+    size_type slen = length();
     int res = memcmp(data(), other, min(slen, other_slen));
     if (res == 0) {
         if (slen < other_slen) {
@@ -23,4 +24,21 @@ int string::compareInternal(const char* other, u32 other_slen) const {
         }
     }
     return res;
-}
\ No newline at end of file
+}
+
+// Lengths are already known to be equal.
+template<typename Traits>
+bool basic_string<Traits>::equalsInternal(const basic_string& s) const {
+    const char* a = data();
+    const char* b = s.data();
+    if (a == b) {
+        return true;
+    }
+    // Two canonical copies of the same text would be one buffer.
+    if (isInterned() && s.isInterned()) {
+        return false;
+    }
+    return memcmp(a, b, length()) == 0;
+}
+
+INSTANTIATE_STRINGS
@@ -0,0 +1,286 @@
+#include "string.hpp"
+
+/* Cords are AVL trees: every concatenation node records its depth,
+ * and joining two trees whose depths differ by more than one walks
+ * down the spine of the deeper one and rotates on the way back up
+ * (Blelloch, Ferizovic and Sun, "Just Join for Parallel Ordered
+ * Sets"), so a join costs O(|depth difference|). Nodes are shared
+ * between cords and never modified once built; a node we hold the
+ * only reference to is taken apart instead of copied. */
+
+struct cord::Node {
+    std::atomic<int32_t> refs;
+    uint8_t depth; // 0 for leaves
+    size_type len;
+    Node* left;
+    Node* right;
+    string chunk; // leaves only
+    std::atomic<Node*> flat; // a leaf holding the same text, once flattened
+};
+
+typedef cord::size_type size_type;
+
+static cord::Node* ref(cord::Node* n) {
+    if (n) {
+        n->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return n;
+}
+static void unref(cord::Node* n) {
+    if (n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        unref(n->left);
+        unref(n->right);
+        unref(n->flat.load(std::memory_order_acquire));
+        delete n;
+    }
+}
+
+static cord::Node* leaf(string chunk) {
+    if (chunk.length() == 0) {
+        return nullptr;
+    }
+    cord::Node* n = new cord::Node();
+    n->refs.store(1, std::memory_order_relaxed);
+    n->len = chunk.length();
+    n->chunk = std::move(chunk);
+    return n;
+}
+// Takes the caller's references to l and r.
+static cord::Node* node(cord::Node* l, cord::Node* r) {
+    cord::Node* n = new cord::Node();
+    n->refs.store(1, std::memory_order_relaxed);
+    n->depth = (l->depth > r->depth ? l->depth : r->depth) + 1;
+    n->len = l->len + r->len;
+    n->left = l;
+    n->right = r;
+    return n;
+}
+// Gives up the caller's reference to n for references to its children.
+static void expose(cord::Node* n, cord::Node** l, cord::Node** r) {
+    if (n->refs.load(std::memory_order_acquire) == 1) {
+        *l = n->left;
+        *r = n->right;
+        n->left = n->right = nullptr;
+    } else {
+        *l = ref(n->left);
+        *r = ref(n->right);
+    }
+    unref(n);
+}
+
+/* Leaves this short are merged rather than paired, so that a run
+ * of small appends doesn't cost one node per append. Merging copies
+ * at most this many bytes. */
+#define MERGE_LIMIT 256
+static cord::Node* pair(cord::Node* l, cord::Node* r) {
+    if (l->depth == 0 && r->depth == 0 && l->len + r->len <= MERGE_LIMIT) {
+        cord::Node* n = leaf(l->chunk + r->chunk);
+        unref(l);
+        unref(r);
+        return n;
+    }
+    return node(l, r);
+}
+#undef MERGE_LIMIT
+
+// node(a, node(b, c)) -> node(node(a, b), c)
+static cord::Node* rotateLeft(cord::Node* n) {
+    cord::Node *a, *bc, *b, *c;
+    expose(n, &a, &bc);
+    expose(bc, &b, &c);
+    return node(node(a, b), c);
+}
+// node(node(a, b), c) -> node(a, node(b, c))
+static cord::Node* rotateRight(cord::Node* n) {
+    cord::Node *ab, *c, *a, *b;
+    expose(n, &ab, &c);
+    expose(ab, &a, &b);
+    return node(a, node(b, c));
+}
+
+// l is more than one level deeper than r.
+static cord::Node* joinRight(cord::Node* l, cord::Node* r) {
+    cord::Node *ll, *c;
+    expose(l, &ll, &c);
+    if (c->depth <= r->depth + 1) {
+        cord::Node* t = pair(c, r);
+        if (t->depth <= ll->depth + 1) {
+            return node(ll, t);
+        }
+        return rotateLeft(node(ll, rotateRight(t)));
+    }
+    cord::Node* t = joinRight(c, r);
+    if (t->depth <= ll->depth + 1) {
+        return node(ll, t);
+    }
+    return rotateLeft(node(ll, t));
+}
+// r is more than one level deeper than l.
+static cord::Node* joinLeft(cord::Node* l, cord::Node* r) {
+    cord::Node *c, *rr;
+    expose(r, &c, &rr);
+    if (c->depth <= l->depth + 1) {
+        cord::Node* t = pair(l, c);
+        if (t->depth <= rr->depth + 1) {
+            return node(t, rr);
+        }
+        return rotateRight(node(rotateLeft(t), rr));
+    }
+    cord::Node* t = joinLeft(l, c);
+    if (t->depth <= rr->depth + 1) {
+        return node(t, rr);
+    }
+    return rotateRight(node(t, rr));
+}
+// Takes the caller's references to l and r; either may be empty.
+static cord::Node* join(cord::Node* l, cord::Node* r) {
+    if (!l) {
+        return r;
+    }
+    if (!r) {
+        return l;
+    }
+    if (l->depth > r->depth + 1) {
+        return joinRight(l, r);
+    }
+    if (r->depth > l->depth + 1) {
+        return joinLeft(l, r);
+    }
+    return pair(l, r);
+}
+
+// Borrows n. Leaves are cut with string::substring, so they share
+// the chunk's buffer instead of copying it.
+static cord::Node* slice(cord::Node* n, size_type start, size_type end) {
+    if (start >= end) {
+        return nullptr;
+    }
+    if (start == 0 && end == n->len) {
+        return ref(n);
+    }
+    if (n->depth == 0) {
+        return leaf(n->chunk.substring(start, end));
+    }
+    size_type mid = n->left->len;
+    if (end <= mid) {
+        return slice(n->left, start, end);
+    }
+    if (start >= mid) {
+        return slice(n->right, start - mid, end - mid);
+    }
+    return join(
+        slice(n->left, start, mid),
+        slice(n->right, 0, end - mid)
+    );
+}
+
+/* static */
+char* cord::write(const Node* n, char* dst) {
+    while (n->depth != 0) {
+        dst = write(n->left, dst);
+        n = n->right;
+    }
+    memcpy(dst, n->chunk.data(), n->len);
+    return dst + n->len;
+}
+
+cord::cord(Node* root) : root(root) {}
+cord::cord() : root(nullptr) {}
+cord::cord(const string& s) : root(leaf(s)) {}
+cord::~cord() {
+    unref(root);
+}
+cord::cord(const cord& c) : root(ref(c.root)) {}
+cord& cord::operator=(const cord& c) {
+    Node* old = root;
+    root = ref(c.root);
+    unref(old);
+    return *this;
+}
+cord::cord(cord&& c) : root(c.root) {
+    c.root = nullptr;
+}
+cord& cord::operator=(cord&& c) {
+    if (this != &c) {
+        unref(root);
+        root = c.root;
+        c.root = nullptr;
+    }
+    return *this;
+}
+
+size_type cord::length() const {
+    return root ? root->len : 0;
+}
+
+// Returns a borrowed leaf holding the whole text, or null if empty.
+cord::Node* cord::flatten() const {
+    if (!root || root->depth == 0) {
+        return root;
+    }
+    Node* flat = root->flat.load(std::memory_order_acquire);
+    if (flat) {
+        return flat;
+    }
+    string s((string::ssize_type)root->len);
+    write(root, s.data());
+    Node* n = leaf(std::move(s));
+    if (root->flat.compare_exchange_strong(
+        flat, n, std::memory_order_acq_rel, std::memory_order_acquire
+    )) {
+        return n;
+    }
+    unref(n);
+    return flat;
+}
+
+char cord::operator[](size_type i) const {
+    Node* n = root->flat.load(std::memory_order_acquire);
+    if (!n) {
+        n = root;
+    }
+    while (n->depth != 0) {
+        size_type mid = n->left->len;
+        if (i < mid) {
+            n = n->left;
+        } else {
+            i -= mid;
+            n = n->right;
+        }
+    }
+    return n->chunk[i];
+}
+
+cord cord::substring(size_type start) const {
+    return substring(start, length());
+}
+cord cord::substring(size_type start, size_type end) const {
+    size_type len = length();
+    if (end > len) {
+        end = len;
+    }
+    if (!root) {
+        return cord();
+    }
+    Node* n = root->flat.load(std::memory_order_acquire);
+    return cord(slice(n ? n : root, start, end));
+}
+
+cord operator+(const cord& a, const cord& b) {
+    return cord(join(ref(a.root), ref(b.root)));
+}
+void cord::operator+=(const cord& c) {
+    root = join(root, ref(c.root));
+}
+void cord::prepend(const cord& c) {
+    root = join(ref(c.root), root);
+}
+
+string cord::str() const {
+    Node* n = flatten();
+    return n ? n->chunk : string();
+}
+const char* cord::data() const {
+    Node* n = flatten();
+    return n ? n->chunk.data() : "";
+}
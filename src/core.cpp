@@ -1,7 +1,16 @@
 #include "string.hpp"
 #include <atomic>
+#include <mutex>
 #include <stdlib.h>
+#include <stdio.h>
+#include <limits>
 #include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 typedef uint64_t u64;
 typedef int64_t i64;
@@ -12,133 +21,733 @@ typedef int16_t i16;
 typedef uint8_t u8;
 typedef int8_t i8;
 
-typedef std::atomic<u32> refc_t;
-
 constexpr static u32 IS_LITTLE_ENDIAN_HELPER = 1;
 constexpr static bool IS_LITTLE_ENDIAN = (const u8&)IS_LITTLE_ENDIAN_HELPER;
 
+/* Biased reference counting (Choi, Shull and Torrellas, PACT '18).
+ *
+ * Most strings are only ever copied and dropped by the thread that
+ * built them, so that thread (the owner) counts its references in
+ * `biased` with plain loads and stores. Every other thread counts in
+ * `shared` with atomics. The object is dead when the two sum to zero.
+ *
+ * `shared` holds the count times SHARED_ONE plus two flags. MERGED
+ * means the owner has folded `biased` into `shared` and given up
+ * ownership, after which `shared` alone is the count. A non-owner
+ * whose decrement takes `shared` below zero (it dropped a reference
+ * the owner counted) sets QUEUED and hands the object to the owner,
+ * which merges it the next time it allocates, or when it exits.
+ * Queued objects are only ever freed by whoever clears QUEUED.
+ */
+#define MERGED 1
+#define QUEUED 2
+#define SHARED_ONE 4
+#define SHARED_COUNT(s) ((s) & ~(MERGED | QUEUED))
+
+#define NO_OWNER 0
+// Merged like NO_OWNER, and the canonical copy in the intern table.
+#define INTERNED (UINT32_MAX - 1)
+#define NOT_REGISTERED UINT32_MAX
+
+typedef string_base::HashCache HashCache;
+
+struct Header {
+    std::atomic<u32> owner;
+    std::atomic<u32> biased;
+    std::atomic<i32> shared;
+    // see hashCache()
+    std::atomic<u32> hash_len;
+    // same as the footer, for frees that only have the header
+    u64 alloc_size;
+    std::atomic<u64> hash;
+};
+
+struct BiasOwner {
+    std::mutex lock;
+    std::atomic<bool> pending;
+    Header** queue;
+    u32 queue_len, queue_cap;
+    /* Headers naming this owner that have not been merged yet number
+     * owned - disowned. Only the owner touches owned; other threads
+     * count in disowned under lock, and read owned once dead is set. */
+    u32 owned;
+    u32 disowned;
+    bool dead;
+};
+
+static std::mutex owners_lock;
+static BiasOwner** owners;
+static u32 owners_len, owners_cap;
+// ids of retired owners, for reuse
+static u32* free_ids;
+static u32 free_ids_len;
+
+static thread_local u32 current_owner = NOT_REGISTERED;
+static thread_local BiasOwner* current_record;
+static thread_local bool owner_exited;
+
+static void freeHeader(Header*);
+
 /* Allocated memory layout (least -> greatest ptr)
-Reference count - sizeof(refc_t)
+Header          - sizeof(Header)
 String data     - alloc length
 Extra space     - alloc capacity - alloc length
 Zero terminator - 1
-Allocation size - sizeof(u32) 
+Allocation size - sizeof(size_type)
 
-Note: allocation size is little-endian */
+Note: allocation size is little-endian. The helpers below are
+templates on size_type so that string64 gets an 8-byte footer. */
 
 #define SSO_CAP (sizeof(alloc)-1)
 #define SSO_DATA ((char*)&alloc)
 #define SSO_INFO (*(SSO_DATA + SSO_CAP))
 #define SSO_DATA_FOR(obj) ((char*)&(obj)->alloc)
 
-static void storeU32(char* dst, u32 val) {
+template<typename S> static void storeSize(char* dst, S val) {
+    if (IS_LITTLE_ENDIAN) {
+        memcpy(dst, &val, sizeof(S));
+        return;
+    }
     u8* dest = (u8*)dst;
-    *(dest++) = (u8)val;
-    val >>= 8;
-    *(dest++) = (u8)val;
-    val >>= 8;
-    *(dest++) = (u8)val;
-    val >>= 8;
-    *(dest++) = (u8)val;
-}
-static u32 loadU32(char* src) {
+    for (size_t i = 0; i < sizeof(S); i++) {
+        *(dest++) = (u8)val;
+        val >>= 8;
+    }
+}
+template<typename S> static S loadSize(char* src) {
+    S val = 0;
+    if (IS_LITTLE_ENDIAN) {
+        memcpy(&val, src, sizeof(S));
+        return val;
+    }
     u8* source = (u8*)src;
-    u32 val = *(source++);
-    val |= (*(source++)) << 8;
-    val |= (*(source++)) << 16;
-    val |= (*(source++)) << 24;
+    for (size_t i = 0; i < sizeof(S); i++) {
+        val |= (S)source[i] << (8*i);
+    }
     return val;
 }
-static char* allocWithFooter(u32 len) {
-    u32 alloc_size = sizeof(refc_t) + len + 1 + 4;
-    char* memory = (char*)malloc(alloc_size);
-    new (memory) refc_t(1);
-    storeU32(memory+alloc_size-4, alloc_size);
-    return memory+sizeof(refc_t);
+static BiasOwner* ownerRecord(u32 id) {
+    std::lock_guard<std::mutex> guard(owners_lock);
+    return owners[id - 1];
+}
+/* No header names a retired owner any more, so its id can go to
+ * the next thread that registers. */
+static void retireOwner(u32 id) {
+    BiasOwner* rec;
+    {
+        std::lock_guard<std::mutex> guard(owners_lock);
+        rec = owners[id - 1];
+        owners[id - 1] = nullptr;
+        free_ids[free_ids_len++] = id;
+    }
+    free(rec->queue);
+    delete rec;
+}
+// Owner side of a merge; returns the resulting shared word.
+static i32 mergeBiased(Header* h) {
+    u32 biased = h->biased.load(std::memory_order_relaxed);
+    h->owner.store(NO_OWNER, std::memory_order_relaxed);
+    return h->shared.fetch_add(
+        (i32)(biased * SHARED_ONE) | MERGED,
+        std::memory_order_acq_rel
+    ) + (i32)(biased * SHARED_ONE) + MERGED;
+}
+// Merges a queued header and clears QUEUED; frees it if it is dead.
+static void mergeQueued(Header* h) {
+    if (!(h->shared.load(std::memory_order_relaxed) & MERGED)) {
+        mergeBiased(h);
+    }
+    i32 now = h->shared.fetch_and(
+        ~QUEUED, std::memory_order_acq_rel
+    ) & ~QUEUED;
+    if (SHARED_COUNT(now) == 0) {
+        freeHeader(h);
+    }
+}
+static void processQueue(BiasOwner* rec) {
+    rec->pending.store(false, std::memory_order_relaxed);
+    Header** queue;
+    u32 queue_len;
+    {
+        std::lock_guard<std::mutex> guard(rec->lock);
+        queue = rec->queue;
+        queue_len = rec->queue_len;
+        rec->queue = nullptr;
+        rec->queue_len = rec->queue_cap = 0;
+    }
+    for (u32 i = 0; i < queue_len; i++) {
+        Header* h = queue[i];
+        if (!(h->shared.load(std::memory_order_relaxed) & MERGED)) {
+            rec->owned--;
+        }
+        mergeQueued(h);
+    }
+    free(queue);
+}
+
+/* The thread-locals in this file with destructors are constructed
+ * together, the first time any of them is used, so each destructor
+ * may run on a thread that never used it. */
+struct OwnerExit {
+    ~OwnerExit() {
+        BiasOwner* rec = current_record;
+        u32 id = current_owner;
+        if (!rec) {
+            return;
+        }
+        processQueue(rec);
+        bool last;
+        {
+            std::lock_guard<std::mutex> guard(rec->lock);
+            rec->dead = true;
+            last = rec->owned == rec->disowned;
+        }
+        /* From here on this thread counts like any other thread,
+         * so that other threads can merge what it still owns. */
+        current_owner = NOT_REGISTERED;
+        current_record = nullptr;
+        owner_exited = true;
+        if (last) {
+            retireOwner(id);
+        }
+    }
+};
+static thread_local OwnerExit owner_exit;
+
+static u32 registerOwner() {
+    BiasOwner* rec = new BiasOwner();
+    u32 id;
+    {
+        std::lock_guard<std::mutex> guard(owners_lock);
+        if (free_ids_len) {
+            id = free_ids[--free_ids_len];
+        } else {
+            if (owners_len == owners_cap) {
+                owners_cap = owners_cap ? owners_cap * 2 : 16;
+                owners = (BiasOwner**)realloc(
+                    owners, owners_cap * sizeof(BiasOwner*)
+                );
+                free_ids = (u32*)realloc(free_ids, owners_cap * sizeof(u32));
+            }
+            id = ++owners_len;
+        }
+        owners[id - 1] = rec;
+    }
+    current_owner = id;
+    current_record = rec;
+    (void)&owner_exit;
+    return id;
+}
+
+// Called by a non-owner that took `shared` below zero.
+static void enqueueForOwner(Header* h, u32 id) {
+    BiasOwner* rec = ownerRecord(id);
+    bool retire = false;
+    {
+        std::lock_guard<std::mutex> guard(rec->lock);
+        if (!rec->dead) {
+            if (rec->queue_len == rec->queue_cap) {
+                rec->queue_cap = rec->queue_cap ? rec->queue_cap * 2 : 8;
+                rec->queue = (Header**)realloc(
+                    rec->queue, rec->queue_cap * sizeof(Header*)
+                );
+            }
+            rec->queue[rec->queue_len++] = h;
+            rec->pending.store(true, std::memory_order_relaxed);
+            return;
+        }
+        // The owner is gone and can no longer touch `biased`.
+        rec->disowned++;
+        retire = rec->owned == rec->disowned;
+    }
+    mergeQueued(h);
+    if (retire) {
+        retireOwner(id);
+    }
+}
+
+static void initHeader(Header* h) {
+    u32 id = current_owner;
+    if (id == NOT_REGISTERED && !owner_exited) {
+        id = registerOwner();
+    }
+    if (id == NOT_REGISTERED) {
+        new (&h->owner) std::atomic<u32>(NO_OWNER);
+        new (&h->biased) std::atomic<u32>(0);
+        new (&h->shared) std::atomic<i32>(SHARED_ONE | MERGED);
+        new (&h->hash_len) std::atomic<u32>(0);
+        new (&h->hash) std::atomic<u64>(0);
+        return;
+    }
+    BiasOwner* rec = current_record;
+    if (rec->pending.load(std::memory_order_relaxed)) {
+        processQueue(rec);
+    }
+    rec->owned++;
+    new (&h->owner) std::atomic<u32>(id);
+    new (&h->biased) std::atomic<u32>(1);
+    new (&h->shared) std::atomic<i32>(0);
+    new (&h->hash_len) std::atomic<u32>(0);
+    new (&h->hash) std::atomic<u64>(0);
+}
+static void increfHeader(Header* h) {
+    if (h->owner.load(std::memory_order_relaxed) == current_owner) {
+        // relaxed load + store compiles to a plain increment
+        h->biased.store(
+            h->biased.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed
+        );
+        return;
+    }
+    h->shared.fetch_add(SHARED_ONE, std::memory_order_relaxed);
 }
-static u32 nextHighestPowerOfTwo(u32 v) {
+static void decrefHeader(Header* h) {
+    if (h->owner.load(std::memory_order_relaxed) == current_owner) {
+        u32 biased = h->biased.load(std::memory_order_relaxed) - 1;
+        h->biased.store(biased, std::memory_order_relaxed);
+        if (biased != 0) {
+            return;
+        }
+        current_record->owned--;
+        i32 now = mergeBiased(h);
+        if (SHARED_COUNT(now) == 0 && !(now & QUEUED)) {
+            freeHeader(h);
+        }
+        return;
+    }
+
+    /* If thread A writes to the string data (perhaps appending),
+    * gives a copy of the string to thread B, then
+    * thread A drops the string, then thread B drops
+    * the string, deallocating the memory, the writes
+    * by thread A may not have been synchronized across
+    * all threads. So, if thread C reallocates the same
+    * memory and begins using it for some other purpose,
+    * thread A's writes may suddenly synchronize,
+    * corrupting thread C's memory.
+    *
+    * Thus, we must flush any writes to the string when
+    * we drop it.
+    *
+    * Another potential situation is accessing string[0]
+    * for example, and then destructing the string.
+    * If the string destructor is reordered before the
+    * read access, another thread may deallocate the memory,
+    * another thread may recycle it for another purpose,
+    * and then string[0] would return invalid data.
+    * So, we must also ensure all reads occur before the
+    * ref_count is decremented.
+    *
+    * The owner thread gets the same guarantee from the
+    * acq_rel read-modify-write in mergeBiased.
+    */
+
+    /* "the release operation: no reads or writes in the
+    * current thread can be reordered after this store"
+    * https://en.cppreference.com/w/cpp/atomic/memory_order
+    */
+    i32 now = h->shared.fetch_sub(
+        SHARED_ONE, std::memory_order_release
+    ) - SHARED_ONE;
+    if (now < 0 && !(now & (MERGED | QUEUED))) {
+        /* We dropped a reference the owner counted. Until QUEUED
+         * is set nobody else can merge or free the object: the
+         * owner's count cannot reach zero on its own any more. */
+        if (!(h->shared.fetch_or(QUEUED, std::memory_order_relaxed) & QUEUED)) {
+            enqueueForOwner(h, h->owner.load(std::memory_order_relaxed));
+        }
+        return;
+    }
+    if (SHARED_COUNT(now) != 0 || (now & (MERGED | QUEUED)) != MERGED) {
+        return;
+    }
+
+    /* "the acquire operation...All writes in other threads
+    * that release the same atomic variable are visible
+    * in the current thread"
+    * https://en.cppreference.com/w/cpp/atomic/memory_order
+    */
+    (void)h->shared.load(std::memory_order_acquire);
+
+    /* now free() makes the writes visible on all threads
+    * (I think) anyway,
+    * gecko https://searchfox.org/mozilla-central/rev/ae8c2e2354db
+    * 652950fe0ec16983360c21857f2a/xpcom/base/nsISupportsImpl.h#337
+    * uses this pattern and it seems to work for them
+    */
+    freeHeader(h);
+}
+/* Number of references, exact on the owning thread or once merged.
+ * Elsewhere the owner's count cannot be read, so the answer is only
+ * guaranteed not to be 1 unless the object is uniquely referenced. */
+static u32 refcntHeader(const Header* h) {
+    i32 shared = h->shared.load(std::memory_order_acquire);
+    u32 owner = h->owner.load(std::memory_order_relaxed);
+    if (owner == NO_OWNER || owner == INTERNED) {
+        return SHARED_COUNT(shared) / SHARED_ONE;
+    }
+    if (owner != current_owner) {
+        return 2;
+    }
+    return h->biased.load(std::memory_order_relaxed)
+        + SHARED_COUNT(shared) / SHARED_ONE;
+}
+/* A uniquely referenced header can move unless it is interned or
+ * queued for its owner to merge, whose queue holds its address. */
+static bool movableHeader(Header* h) {
+    return h->owner.load(std::memory_order_relaxed) != INTERNED
+        && !(h->shared.load(std::memory_order_acquire) & QUEUED);
+}
+// Drops ownership bookkeeping for a uniquely referenced header being freed or moved.
+static void disownHeader(Header* h) {
+    u32 owner = h->owner.load(std::memory_order_relaxed);
+    if (owner == NO_OWNER || owner == INTERNED) {
+        return;
+    }
+    if (owner == current_owner) {
+        current_record->owned--;
+    } else {
+        BiasOwner* rec = ownerRecord(owner);
+        bool retire;
+        {
+            std::lock_guard<std::mutex> guard(rec->lock);
+            rec->disowned++;
+            retire = rec->dead && rec->owned == rec->disowned;
+        }
+        if (retire) {
+            retireOwner(owner);
+        }
+    }
+}
+
+/* With STRING_STATS, each thread counts into a block of its own with
+ * plain loads and stores. Blocks are never freed: a thread that exits
+ * hands its block to the next thread that starts counting, so stats()
+ * just sums every block there is. Counts made while the exiting
+ * thread tears down go to a shared block with atomic adds. */
+#define STAT_COUNT (sizeof(string_base::Stats) / sizeof(u64))
+#ifdef STRING_STATS
+struct StatsBlock {
+    std::atomic<u64> counts[STAT_COUNT];
+    StatsBlock* next; // in stats_blocks
+    StatsBlock* next_free;
+};
+static std::mutex stats_lock;
+static StatsBlock* stats_blocks;
+static StatsBlock* stats_free;
+static StatsBlock stats_exiting;
+static u64 stats_baseline[STAT_COUNT];
+static thread_local StatsBlock* current_stats;
+static thread_local bool stats_exited;
+
+struct StatsExit {
+    ~StatsExit() {
+        if (!current_stats) {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(stats_lock);
+        current_stats->next_free = stats_free;
+        stats_free = current_stats;
+        current_stats = nullptr;
+        stats_exited = true;
+    }
+};
+static thread_local StatsExit stats_exit;
+
+static StatsBlock* registerStats() {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    StatsBlock* b = stats_free;
+    if (b) {
+        stats_free = b->next_free;
+    } else {
+        b = new StatsBlock();
+        b->next = stats_blocks;
+        stats_blocks = b;
+    }
+    current_stats = b;
+    (void)&stats_exit;
+    return b;
+}
+static void countStat(size_t i, u64 n) {
+    StatsBlock* b = current_stats;
+    if (!b) {
+        if (stats_exited) {
+            stats_exiting.counts[i].fetch_add(n, std::memory_order_relaxed);
+            return;
+        }
+        b = registerStats();
+    }
+    // relaxed load + store compiles to a plain add
+    b->counts[i].store(
+        b->counts[i].load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed
+    );
+}
+// Caller holds stats_lock.
+static void sumStats(u64* total) {
+    for (size_t i = 0; i < STAT_COUNT; i++) {
+        total[i] = stats_exiting.counts[i].load(std::memory_order_relaxed);
+    }
+    for (StatsBlock* b = stats_blocks; b; b = b->next) {
+        for (size_t i = 0; i < STAT_COUNT; i++) {
+            total[i] += b->counts[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+#define COUNT(field, n) \
+    countStat(offsetof(string_base::Stats, field) / sizeof(u64), (n))
+#else
+#define COUNT(field, n) ((void)0)
+#endif
+
+string_base::Stats string_base::stats() {
+    u64 counts[STAT_COUNT] = {};
+#ifdef STRING_STATS
+    std::lock_guard<std::mutex> guard(stats_lock);
+    sumStats(counts);
+    for (size_t i = 0; i < STAT_COUNT; i++) {
+        counts[i] -= stats_baseline[i];
+    }
+#endif
+    Stats res;
+    memcpy(&res, counts, sizeof(res));
+    return res;
+}
+void string_base::resetStats() {
+#ifdef STRING_STATS
+    std::lock_guard<std::mutex> guard(stats_lock);
+    sumStats(stats_baseline);
+#endif
+}
+
+template<typename S> static char* allocWithFooter(S len) {
+    S alloc_size = sizeof(Header) + len + 1 + sizeof(S);
+    char* memory = (char*)string_base::getAllocator().allocate(alloc_size);
+    COUNT(allocations, 1);
+    COUNT(bytes_allocated, alloc_size);
+    initHeader((Header*)memory);
+    ((Header*)memory)->alloc_size = alloc_size;
+    storeSize<S>(memory+alloc_size-sizeof(S), alloc_size);
+    return memory+sizeof(Header);
+}
+static u64 nextHighestPowerOfTwo(u64 v) {
     v--;
     v |= v >> 1;
     v |= v >> 2;
     v |= v >> 4;
     v |= v >> 8;
     v |= v >> 16;
+    v |= v >> 32;
     v++;
     return v;
 }
-typedef struct {
+template<typename S> struct Vec {
     char* data;
-    u32 cap;
-} Vec;
-static Vec allocVectorWithFooter(u32 needed_cap) {
-    u32 alloc_size = nextHighestPowerOfTwo(
-        sizeof(refc_t) + needed_cap + 1 + 4
+    S cap;
+};
+template<typename S> static Vec<S> allocVectorWithFooter(S needed_cap) {
+    S alloc_size = (S)nextHighestPowerOfTwo(
+        sizeof(Header) + (u64)needed_cap + 1 + sizeof(S)
+    );
+    S actual_cap = alloc_size - sizeof(Header) - 1 - sizeof(S);
+    char* memory = (char*)string_base::getAllocator().allocate(alloc_size);
+    COUNT(allocations, 1);
+    COUNT(bytes_allocated, alloc_size);
+    initHeader((Header*)memory);
+    ((Header*)memory)->alloc_size = alloc_size;
+    storeSize<S>(memory+alloc_size-sizeof(S), alloc_size);
+    return Vec<S>{memory+sizeof(Header), actual_cap};
+}
+template<typename S> static S getAllocSize(char* data, S cap) {
+    return loadSize<S>(data + cap + 1);
+}
+template<typename S> static char* reallocNonSubstringWithFooter(char* data, S cap, S new_cap) {
+    S alloc_size = sizeof(Header) + new_cap + 1 + sizeof(S);
+    char* existing = data - sizeof(Header);
+    S old_size = getAllocSize(data, cap);
+    char* memory = (char*)string_base::getAllocator().reallocate(
+        existing, old_size, alloc_size
     );
-    u32 actual_cap = alloc_size - sizeof(refc_t) - 1 - 4;
-    char* memory = (char*)malloc(alloc_size);
-    new (memory) refc_t(1);
-    storeU32(memory+alloc_size-4, alloc_size);
-    return Vec{memory+sizeof(refc_t), actual_cap};
-}
-static char* reallocNonSubstringWithFooter(char* data, u32 new_cap) {
-    u32 alloc_size = sizeof(refc_t) + new_cap + 1 + 4;
-    char* existing = data - sizeof(refc_t);
-    char* memory = (char*)realloc(existing, alloc_size);
-    storeU32(memory+alloc_size-4, alloc_size);
-    return memory+sizeof(refc_t);
-}
-static refc_t* getRefCount(char* data, u32 cap) {
+    COUNT(allocations, 1);
+    COUNT(bytes_allocated, alloc_size);
+    COUNT(frees, 1);
+    COUNT(bytes_freed, old_size);
+    ((Header*)memory)->alloc_size = alloc_size;
+    storeSize<S>(memory+alloc_size-sizeof(S), alloc_size);
+    return memory+sizeof(Header);
+}
+template<typename S> static void freeNonSubstringWithFooter(char* data, S cap) {
+    disownHeader((Header*)(data - sizeof(Header)));
+    S size = getAllocSize(data, cap);
+    COUNT(frees, 1);
+    COUNT(bytes_freed, size);
+    string_base::getAllocator().deallocate(data - sizeof(Header), size);
+}
+template<typename S> static Header* getHeader(char* data, S cap) {
     char* size_ptr = data + cap + 1;
-    u32 alloc_size = loadU32(size_ptr);
-    return (refc_t*)(size_ptr + 4 - alloc_size);
+    S alloc_size = loadSize<S>(size_ptr);
+    return (Header*)(size_ptr + sizeof(S) - alloc_size);
+}
+/* Set in Header::alloc_size (never in the footer) for mapFile()
+ * strings, whose header sits just after a Mapping record. */
+#define MAPPED ((u64)1 << 63)
+struct Mapping {
+    void* base;
+    size_t len;
+};
+/* Set in Header::alloc_size for adopt() strings, whose header sits
+ * in the buffer's spare capacity after the text, just after an
+ * Adoption record. */
+#define ADOPTED ((u64)1 << 62)
+struct Adoption {
+    void (*release)(void*);
+    void* context;
+};
+static void freeHeader(Header* h) {
+    if (h->alloc_size & ADOPTED) {
+        Adoption* a = (Adoption*)h - 1;
+        a->release(a->context);
+        return;
+    }
+#ifndef _WIN32
+    if (h->alloc_size & MAPPED) {
+        Mapping* m = (Mapping*)h - 1;
+        munmap(m->base, m->len);
+        return;
+    }
+#endif
+    COUNT(frees, 1);
+    COUNT(bytes_freed, h->alloc_size);
+    string_base::getAllocator().deallocate(h, h->alloc_size);
+}
+#define GET_HEADER() (getHeader(alloc.data, getAllocCap()))
+
+/* Substrings don't know their parent, only the buffer behind it, so
+ * both the compaction policy and the pin count go by the size of the
+ * whole allocation. They take it from the footer, which finding the
+ * header has to load anyway. */
+#define ALLOC_SIZE() (getAllocSize(alloc.data, getAllocCap()))
+/* Mapped and adopted text is released by its owner as a whole, so
+ * copying out of it saves nothing and it never counts as pinned. */
+#define HEAP_SIZE() (GET_HEADER()->alloc_size & (MAPPED | ADOPTED) ? 0 : ALLOC_SIZE())
+string_base::CompactionPolicy string_base::compaction = {
+    (u64)1 << 20, 1.0 / 64, UINT64_MAX, (u64)1 << 16
+};
+string_base::GrowthPolicy string_base::growth = {
+    1.5, (u64)1 << 16
+};
+void string_base::setGrowthPolicy(const GrowthPolicy& g) {
+    growth = g;
+}
+
+// Smaller buffers are never compacted from: the only test most substrings pay.
+static u64 compaction_floor = (u64)1 << 20;
+void string_base::setCompactionPolicy(const CompactionPolicy& p) {
+    compaction = p;
+    compaction_floor = p.max_parent < p.min_parent ? p.max_parent + 1 : p.min_parent;
+}
+static bool shouldCompact(u64 size, u64 len) {
+    if (size < compaction_floor) {
+        return false;
+    }
+    const string_base::CompactionPolicy& p = string_base::getCompactionPolicy();
+    return len <= p.max_copy
+        && (size > p.max_parent || len < size * p.min_fraction);
+}
+
+/* A reference pins a buffer when it uses less than 1/PIN_RATIO of
+ * one of at least PIN_MIN bytes. It is counted from its incref() to
+ * its decref(), which must therefore see the same length: fresh
+ * buffers are never that empty, lengths only grow in place, and
+ * ensureSpaceFor() moves a pinning string out instead of growing it. */
+#define PIN_MIN ((u64)1 << 16)
+#define PIN_RATIO 16
+static std::atomic<u64> pinned_refs, pinned_bytes;
+static u64 pinnedBytes(u64 size, u64 len) {
+    if (size < PIN_MIN || len >= size / PIN_RATIO) {
+        return 0;
+    }
+    return size - len;
+}
+static void countPin(u64 size, u64 len) {
+    u64 pinned = pinnedBytes(size, len);
+    if (pinned) {
+        pinned_refs.fetch_add(1, std::memory_order_relaxed);
+        pinned_bytes.fetch_add(pinned, std::memory_order_relaxed);
+    }
+}
+static void uncountPin(u64 size, u64 len) {
+    u64 pinned = pinnedBytes(size, len);
+    if (pinned) {
+        pinned_refs.fetch_sub(1, std::memory_order_relaxed);
+        pinned_bytes.fetch_sub(pinned, std::memory_order_relaxed);
+    }
+}
+string_base::PinStats string_base::pinStats() {
+    return PinStats{
+        pinned_refs.load(std::memory_order_relaxed),
+        pinned_bytes.load(std::memory_order_relaxed)
+    };
 }
-#define GET_REF_COUNT() (getRefCount(alloc.data, getAllocCap()))
 
 // If big endian, set (v<<1)|1 and retrieve v>>1.
 // If little endian, set v with (top byte<<1)|1, retrieve v with top byte>>1.
-void string::setAllocCap(u32 v) {
+#define TOP_BIT ((size_type)1 << (sizeof(size_type)*8 - 8))
+#define LOW_BITS (TOP_BIT - 1)
+// the largest capacity setAllocCap() can store
+#define MAX_CAP ((size_type)-1 >> 1)
+template<typename Traits>
+void basic_string<Traits>::setAllocCap(size_type v) {
     if (IS_LITTLE_ENDIAN) {
-        alloc.cap_info = (v & 0x00FFFFFF)
-            | ((v & 0xFF000000) << 1) 
-            | 0x01000000;
+        alloc.cap_info = (v & LOW_BITS)
+            | ((v & ~LOW_BITS) << 1) 
+            | TOP_BIT;
     } else {
         alloc.cap_info = (v << 1) | 1;
     }
 }
-u32 string::getAllocCap() const {
-    u32 cap_info = alloc.cap_info;
+template<typename Traits>
+typename basic_string<Traits>::size_type basic_string<Traits>::getAllocCap() const {
+    size_type cap_info = alloc.cap_info;
     if (IS_LITTLE_ENDIAN) {
-        return (cap_info & 0x00FFFFFF) 
-            | ((cap_info & 0xFE000000) >> 1);
+        return (cap_info & LOW_BITS) 
+            | ((cap_info & (~LOW_BITS << 1)) >> 1);
     } else {
         return cap_info >> 1;
     }
 }
-bool string::allocActive() const {
+template<typename Traits>
+bool basic_string<Traits>::allocActive() const {
     return (SSO_INFO & 1)
         && getAllocCap() != 0;
 }
-bool string::ssoActive() const {
+template<typename Traits>
+bool basic_string<Traits>::ssoActive() const {
     return !(SSO_INFO & 1);
 }
-bool string::litActive() const {
+template<typename Traits>
+bool basic_string<Traits>::litActive() const {
     return (SSO_INFO & 1)
         && getAllocCap() == 0;
 }
-void string::setSsoLen(int v) {
+template<typename Traits>
+void basic_string<Traits>::setSsoLen(int v) {
     SSO_INFO = (SSO_CAP - v) << 1;
 }
-int string::getSsoLen() const {
+template<typename Traits>
+int basic_string<Traits>::getSsoLen() const {
     return SSO_CAP - (SSO_INFO >> 1);
 }
-char* string::data() const {
+template<typename Traits>
+char* basic_string<Traits>::data() const {
     if (ssoActive()) {
         return SSO_DATA;
     } else {
         return alloc.data;
     }
 }
-u32 string::length() const {
+template<typename Traits>
+typename basic_string<Traits>::size_type basic_string<Traits>::length() const {
     if (ssoActive()) {
         return getSsoLen();
     } else {
@@ -146,22 +755,27 @@ u32 string::length() const {
     }
 }
 
-string::string() {
+template<typename Traits>
+basic_string<Traits>::basic_string() {
     SSO_DATA[0] = '\0';
     setSsoLen(0);
 }
 
-string::string(const char* str, i32 len, bool is_literal) {
+template<typename Traits>
+basic_string<Traits>::basic_string(const char* str, ssize_type len, bool is_literal) {
     if (len <= SSO_CAP) {
+        COUNT(sso, 1);
         memcpy(SSO_DATA, str, len);
         SSO_DATA[len] = 0;
         setSsoLen(len);
     } else if (is_literal) {
+        COUNT(literal, 1);
         alloc.data = (char*)str;
         alloc.len = len;
         setAllocCap(0);
     } else {
-        char* data = allocWithFooter(len);
+        COUNT(heap, 1);
+        char* data = allocWithFooter<size_type>(len);
         memcpy(data, str, len);
         data[len] = '\0';
         alloc.data = data;
@@ -169,30 +783,36 @@ string::string(const char* str, i32 len, bool is_literal) {
         setAllocCap(len);
     }
 }
-string::string(i32 uninit_len) {
+template<typename Traits>
+basic_string<Traits>::basic_string(ssize_type uninit_len) {
     if (uninit_len <= SSO_CAP) {
+        COUNT(sso, 1);
         SSO_DATA[uninit_len] = '\0';
         setSsoLen(uninit_len);
     } else {
-        char* data = allocWithFooter(uninit_len);
+        COUNT(heap, 1);
+        char* data = allocWithFooter<size_type>(uninit_len);
         data[uninit_len] = '\0';
         alloc.data = data;
         alloc.len = uninit_len;
         setAllocCap(uninit_len);
     }
 }
-string::string(
+template<typename Traits>
+basic_string<Traits>::basic_string(
     const char* one, const char* two, 
-    u32 one_len, u32 two_len
+    size_type one_len, size_type two_len
 ) {
-    u32 total_len = one_len + two_len;
+    size_type total_len = one_len + two_len;
     if (total_len <= SSO_CAP) {
+        COUNT(sso, 1);
         memcpy(SSO_DATA, one, one_len);
         memcpy(SSO_DATA + one_len, two, two_len);
         SSO_DATA[total_len] = '\0';
         setSsoLen(total_len);
     } else {
-        char* data = allocWithFooter(total_len);
+        COUNT(heap, 1);
+        char* data = allocWithFooter<size_type>(total_len);
         memcpy(data, one, one_len);
         memcpy(data + one_len, two, two_len);
         data[total_len] = '\0';
@@ -201,65 +821,43 @@ string::string(
         setAllocCap(total_len);
     }
 }
-void string::incref() const {
-    GET_REF_COUNT()->fetch_add(1, std::memory_order_relaxed);
+template<typename Traits>
+void basic_string<Traits>::incref() const {
+    COUNT(increfs, 1);
+    increfHeader(GET_HEADER());
+    countPin(HEAP_SIZE(), alloc.len);
 }
-void string::decref() const {
-    refc_t* ref_count = GET_REF_COUNT();
-    
-    /* If thread A writes to the string data (perhaps appending),
-    * gives a copy of the string to thread B, then
-    * thread A drops the string, then thread B drops
-    * the string, deallocating the memory, the writes
-    * by thread A may not have been synchronized across
-    * all threads. So, if thread C reallocates the same
-    * memory and begins using it for some other purpose,
-    * thread A's writes may suddenly synchronize,
-    * corrupting thread C's memory.
-    *
-    * Thus, we must flush any writes to the string when
-    * we drop it.
-    *
-    * Another potential situation is accessing string[0]
-    * for example, and then destructing the string.
-    * If the string destructor is reordered before the
-    * read access, another thread may deallocate the memory,
-    * another thread may recycle it for another purpose,
-    * and then string[0] would return invalid data.
-    * So, we must also ensure all reads occur before the
-    * ref_count is decremented.
-    */
-
-    /* "the release operation: no reads or writes in the
-    * current thread can be reordered after this store"
-    * https://en.cppreference.com/w/cpp/atomic/memory_order
-    */
-    if (ref_count->fetch_sub(
-        1, std::memory_order_release
-    ) != 1) {
-        return;
-    }
-
-    /* "the acquire operation...All writes in other threads
-    * that release the same atomic variable are visible
-    * in the current thread"
-    * https://en.cppreference.com/w/cpp/atomic/memory_order
-    */
-    (void)ref_count->load(std::memory_order_acquire);
-
-    /* now free() makes the writes visible on all threads
-    * (I think) anyway,
-    * gecko https://searchfox.org/mozilla-central/rev/ae8c2e2354db
-    * 652950fe0ec16983360c21857f2a/xpcom/base/nsISupportsImpl.h#337
-    * uses this pattern and it seems to work for them
-    */
-    free(ref_count);
+template<typename Traits>
+void basic_string<Traits>::decref() const {
+    COUNT(decrefs, 1);
+    uncountPin(HEAP_SIZE(), alloc.len);
+    decrefHeader(GET_HEADER());
 }
-u32 string::refcnt() const {
-    return GET_REF_COUNT()->load(std::memory_order_relaxed);
+template<typename Traits>
+u32 basic_string<Traits>::refcnt() const {
+    return refcntHeader(GET_HEADER());
 }
-string::string(const string* src, u32 start, u32 end) {
-    u32 len = end - start;
+/* The header caches hash64() for one length. Only views that start
+ * at the beginning of the buffer may use it; other substrings get
+ * nullptr and hash from scratch. A shared buffer's bytes don't change,
+ * but once the last view is shorter than the cached length, appends
+ * and str() write over the bytes it covered, so those drop it, as
+ * writableData() does. */
+template<typename Traits>
+HashCache basic_string<Traits>::hashCache() const {
+    if (!allocActive()) {
+        return HashCache{nullptr, nullptr};
+    }
+    Header* h = GET_HEADER();
+    if (alloc.data != (char*)(h + 1)) {
+        return HashCache{nullptr, nullptr};
+    }
+    return HashCache{&h->hash_len, &h->hash};
+}
+template<typename Traits>
+basic_string<Traits>::basic_string(const basic_string* src, size_type start, size_type end) {
+    size_type len = end - start;
+    COUNT(substrings, 1);
     if (src->ssoActive()) {
         memcpy(
             &alloc, 
@@ -274,24 +872,37 @@ string::string(const string* src, u32 start, u32 end) {
         alloc.cap_info = src->alloc.cap_info;
         if (allocActive()) {
             setAllocCap(getAllocCap() - start);
-            incref();
+            u64 size = HEAP_SIZE();
+            if (shouldCompact(size, len)) {
+                COUNT(substrings_copied, 1);
+                char* str = alloc.data;
+                setSsoLen(0);
+                *this = basic_string(str, len);
+            } else {
+                COUNT(increfs, 1);
+                increfHeader(GET_HEADER());
+                countPin(size, len);
+            }
         }
     }
 }
 
-string::~string() {
+template<typename Traits>
+basic_string<Traits>::~basic_string() {
     if (allocActive()) {
         decref();
     }
 }
 
-string::string(const string& other) {
+template<typename Traits>
+basic_string<Traits>::basic_string(const basic_string& other) {
     memcpy(&alloc, &other.alloc, sizeof(alloc));
     if (allocActive()) {
         incref();
     }
 }
-string& string::operator=(const string& other) {
+template<typename Traits>
+basic_string<Traits>& basic_string<Traits>::operator=(const basic_string& other) {
     if (allocActive()) {
         decref();
     }
@@ -302,12 +913,14 @@ string& string::operator=(const string& other) {
     return *this;
 }
 
-string::string(string&& other) {
+template<typename Traits>
+basic_string<Traits>::basic_string(basic_string&& other) {
     memcpy(&alloc, &other.alloc, sizeof(alloc));
     other.setSsoLen(0);
     SSO_DATA_FOR(&other)[0] = '\0';
 }
-string& string::operator=(string&& other) {
+template<typename Traits>
+basic_string<Traits>& basic_string<Traits>::operator=(basic_string&& other) {
     if (allocActive()) {
         decref();
     }
@@ -317,72 +930,344 @@ string& string::operator=(string&& other) {
     return *this;
 }
 
-const char* string::str() {
+/* Every flavor is already safe to hand to another thread, so
+ * sharing is just a copy (or a move). */
+template<typename Traits>
+basic_string<typename Traits::shared_traits> basic_string<Traits>::share() const& {
+    basic_string<typename Traits::shared_traits> res;
+    memcpy(&res.alloc, &alloc, sizeof(alloc));
+    if (allocActive()) {
+        incref();
+    }
+    return res;
+}
+template<typename Traits>
+basic_string<typename Traits::shared_traits> basic_string<Traits>::share() && {
+    basic_string<typename Traits::shared_traits> res;
+    memcpy(&res.alloc, &alloc, sizeof(alloc));
+    setSsoLen(0);
+    SSO_DATA[0] = '\0';
+    return res;
+}
+
+template<typename Traits>
+const char* basic_string<Traits>::str() {
     if (ssoActive()) {
         return SSO_DATA;
     }
     if (alloc.data[alloc.len] == 0) {
         return alloc.data;
     }
-    if (allocActive() && refcnt() == 1) {
+    // mapped and adopted text isn't ours to write past
+    if (allocActive() && refcnt() == 1
+    && !(GET_HEADER()->alloc_size & (MAPPED | ADOPTED))) {
+        GET_HEADER()->hash_len.store(0, std::memory_order_relaxed);
         alloc.data[alloc.len] = 0;
         return alloc.data;
     }
 
-    *this = string(alloc.data, alloc.len);
-    return alloc.data;
+    COUNT(str_copies, 1);
+    *this = basic_string(alloc.data, alloc.len);
+    // short copies are inline
+    return data();
+}
+
+/* Leaks our reference on purpose and switches to literal mode, so
+ * copies skip reference counting altogether. Substrings and buffers
+ * with spare room are first copied to an exact fit, so the leak is
+ * never bigger than the string itself. */
+template<typename Traits>
+void basic_string<Traits>::makeImmortal() {
+    if (!allocActive()) {
+        return;
+    }
+    if (alloc.data != (char*)(GET_HEADER() + 1)
+    || getAllocCap() != alloc.len) {
+        *this = basic_string(alloc.data, alloc.len);
+    }
+    setAllocCap(0);
+}
+
+template<typename Traits>
+void basic_string<Traits>::compact() {
+    if (!allocActive()) {
+        return;
+    }
+    if (alloc.data != (char*)(GET_HEADER() + 1)
+    || getAllocCap() != alloc.len) {
+        *this = basic_string(alloc.data, alloc.len);
+    }
+}
+
+/* The file is mapped between two anonymous pages. The first ends
+ * with the Mapping record and the Header; the NUL and footer follow
+ * the file's last byte, spilling into the second page if the last
+ * file page is full. A mapped string thus has the heap layout, and
+ * counts, hashes, substrings and searches work on it unchanged. Only
+ * the last decref differs: it unmaps everything. Pages holding file
+ * contents stay read-only, except the last partial one, which gets a
+ * private copy for the footer. Files shorter than a page, and all
+ * files on Windows, are read into a heap string instead. A file that
+ * is truncated while mapped raises SIGBUS when the lost pages are
+ * touched, as with any mapping. */
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::mapFile(const char* path, bool* ok) {
+    if (ok) {
+        *ok = false;
+    }
+    // the footer holds the whole allocation size, and caps lose a bit to SSO_INFO
+    const u64 max_len = (u64)std::numeric_limits<ssize_type>::max()
+        - sizeof(Header) - 1 - sizeof(size_type);
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return basic_string();
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64)st.st_size > max_len) {
+        close(fd);
+        return basic_string();
+    }
+    u64 len = st.st_size;
+    u64 page = sysconf(_SC_PAGESIZE);
+    if (len >= page) {
+        u64 file_span = (len + page - 1) / page * page;
+        size_t total = page + file_span + page;
+        char* base = (char*)mmap(
+            nullptr, total, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+        );
+        if (base == MAP_FAILED) {
+            close(fd);
+            return basic_string();
+        }
+        char* data = base + page;
+        void* file = mmap(
+            data, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0
+        );
+        close(fd);
+        if (file == MAP_FAILED
+        || (len % page != 0 && mprotect(
+            data + file_span - page, page, PROT_READ | PROT_WRITE
+        ) != 0)) {
+            munmap(base, total);
+            return basic_string();
+        }
+        Header* h = (Header*)data - 1;
+        Mapping* m = (Mapping*)h - 1;
+        m->base = base;
+        m->len = total;
+        initHeader(h);
+        u64 alloc_size = sizeof(Header) + len + 1 + sizeof(size_type);
+        h->alloc_size = alloc_size | MAPPED;
+        data[len] = '\0';
+        storeSize<size_type>(data + len + 1, (size_type)alloc_size);
+
+        COUNT(mapped, 1);
+        basic_string res;
+        res.alloc.data = data;
+        res.alloc.len = len;
+        res.setAllocCap(len);
+        if (ok) {
+            *ok = true;
+        }
+        return res;
+    }
+    close(fd);
+#endif
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return basic_string();
+    }
+    basic_string_builder<Traits> builder;
+    size_t n;
+    do {
+        n = fread(builder.writableTail(1 << 16), 1, 1 << 16, f);
+        builder.commit(n);
+    } while (n == (1 << 16) && builder.length() <= max_len);
+    bool failed = ferror(f) || builder.length() > max_len;
+    fclose(f);
+    if (failed) {
+        return basic_string();
+    }
+    if (ok) {
+        *ok = true;
+    }
+    return builder.build();
 }
 
+/* The text is followed by its NUL, then the Adoption record and the
+ * Header at the next 8-byte boundary, then the footer. getAllocCap()
+ * ends just before the footer like everywhere else, so substrings and
+ * getHeader() work unchanged; ensureSpaceFor() knows not to append
+ * over the header. */
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::adopt(
+    char* data, size_type len, size_type capacity,
+    void (*release)(void*), void* context
+) {
+    uintptr_t records = ((uintptr_t)data + len + 1 + 7) & ~(uintptr_t)7;
+    char* footer = (char*)records + sizeof(Adoption) + sizeof(Header);
+    if (len <= SSO_CAP || footer + sizeof(size_type) > data + capacity) {
+        basic_string res(data, len);
+        release(context);
+        return res;
+    }
+    COUNT(adopted, 1);
+    data[len] = '\0';
+    Adoption* a = (Adoption*)records;
+    a->release = release;
+    a->context = context;
+    Header* h = (Header*)(a + 1);
+    initHeader(h);
+    h->alloc_size = (sizeof(Header) + sizeof(size_type)) | ADOPTED;
+    storeSize<size_type>(footer, sizeof(Header) + sizeof(size_type));
 
-void string::ensureSpaceFor(u32 more) {
+    basic_string res;
+    res.alloc.data = data;
+    res.alloc.len = len;
+    res.setAllocCap((size_type)(footer - data - 1));
+    return res;
+}
+/* Short strings would be copied anyway, and resize() only zeroes the
+ * few bytes of spare capacity it is asked for. */
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::adopt(std::string&& s) {
+    size_type len = s.size();
+    if (len <= SSO_CAP || s.capacity() - len < ADOPT_SLACK) {
+        return basic_string(s.data(), len);
+    }
+    std::string* owner = new std::string(std::move(s));
+    owner->resize(len + ADOPT_SLACK);
+    return adopt(&(*owner)[0], len, len + ADOPT_SLACK, [](void* p) {
+        delete (std::string*)p;
+    }, owner);
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::adopt(std::vector<char>&& v) {
+    size_type len = v.size();
+    if (len <= SSO_CAP || v.capacity() - len < ADOPT_SLACK) {
+        return basic_string(v.data(), len);
+    }
+    std::vector<char>* owner = new std::vector<char>(std::move(v));
+    owner->resize(len + ADOPT_SLACK);
+    return adopt(owner->data(), len, len + ADOPT_SLACK, [](void* p) {
+        delete (std::vector<char>*)p;
+    }, owner);
+}
+
+/* Interned strings are counted in `shared` alone, like merged ones,
+ * so the table can read an exact count from any thread when it
+ * evicts. Called on a fresh, exactly sized, unshared buffer. */
+template<typename Traits>
+void basic_string<Traits>::markInterned() {
+    Header* h = GET_HEADER();
+    disownHeader(h);
+    h->owner.store(INTERNED, std::memory_order_relaxed);
+    h->biased.store(0, std::memory_order_relaxed);
+    h->shared.store(SHARED_ONE | MERGED, std::memory_order_relaxed);
+}
+// Substrings of an interned buffer share its header but are not canonical.
+template<typename Traits>
+bool basic_string<Traits>::isInterned() const {
+    if (!allocActive() || getAllocCap() != alloc.len) {
+        return false;
+    }
+    Header* h = GET_HEADER();
+    return alloc.data == (char*)(h + 1)
+        && h->owner.load(std::memory_order_relaxed) == INTERNED;
+}
+
+
+template<typename Traits>
+void basic_string<Traits>::ensureSpaceFor(size_type more) {
     if (ssoActive()) {
         int sso_len = getSsoLen();
-        u32 needed_cap = sso_len + more;
+        size_type needed_cap = sso_len + more;
         if (needed_cap <= SSO_CAP) {
             return;
         }
-        Vec res = allocVectorWithFooter(needed_cap);
+        COUNT(regrowths, 1);
+        Vec<size_type> res = allocVectorWithFooter(needed_cap);
         memcpy(res.data, SSO_DATA, sso_len+1);
         alloc.data = res.data;
         alloc.len = sso_len;
         setAllocCap(res.cap);
     } else {
-        /* Here we might want to consider using realloc
-         * instead of malloc, so that the allocator can
-         * be more efficient, resizing the existing
-         * memory block if necessary rather than
-         * allocating a completely new one.
-         *
-         * There are considerations that might make this
-         * less efficient. We may be a substring; however,
-         * realloc, if it needs to, will copy the entire allocation,
-         * not just the parts we need. If len < cap, or we are a substring
-         * that starts later than the original allocation, time and memory
-         * will be wasted (potentially a great deal of it).
-         *
-         * Another possibility is only using realloc() if we are a substring
-         * starting at the original location.
-         * 
-         * It seems to me that the best option, or any sort of heuristic
-         * to find the best option, can only really be determined by
-         * benchmarking, and so I will leave it to the future.
-        */
-        u32 needed_cap = alloc.len + more;
-        if (needed_cap <= getAllocCap()) {
+        size_type needed_cap = alloc.len + more;
+        // mapped and adopted text isn't ours to write past
+        if (needed_cap <= getAllocCap()
+        && !(GET_HEADER()->alloc_size & (MAPPED | ADOPTED))
+        && !pinnedBytes(ALLOC_SIZE(), alloc.len)) {
+            GET_HEADER()->hash_len.store(0, std::memory_order_relaxed);
+            return;
+        }
+        COUNT(regrowths, 1);
+        if (growLarge(needed_cap)) {
             return;
         }
-        Vec res = allocVectorWithFooter(needed_cap);
+        Vec<size_type> res = allocVectorWithFooter(needed_cap);
         memcpy(
             res.data, 
             alloc.data, 
             alloc.len
         );
         res.data[alloc.len] = '\0';
+        if (allocActive()) {
+            decref();
+        }
         alloc.data = res.data;
         setAllocCap(res.cap);
     }
 }
-void string::pushSingleton(const char* str, u32 len) {
+/* Past growth.min_large, powers of two waste too much, and a block
+ * that big is one malloc() maps on its own, so realloc() can move it
+ * by remapping pages. It is only used on a buffer we could free
+ * outright; realloc() copies the whole block, so a substring further
+ * in, or one using under half of it, is copied out instead. Returns
+ * false to leave small buffers to the power-of-two path. */
+template<typename Traits>
+bool basic_string<Traits>::growLarge(size_type needed_cap) {
+    if (!allocActive()) {
+        return false;
+    }
+    size_type cap = getAllocCap();
+    const string_base::GrowthPolicy& g = string_base::getGrowthPolicy();
+    if ((u64)needed_cap + sizeof(Header) < g.min_large) {
+        return false;
+    }
+    /* Grow from the length: a substring's cap is what is left of its
+     * parent. The result must not pin (see countPin) at the length it
+     * is grown for, whatever the factor. */
+    double want = (double)alloc.len * g.factor;
+    double most = (double)needed_cap * (PIN_RATIO - 1);
+    if (want > most) {
+        want = most;
+    }
+    size_type new_cap = want > MAX_CAP ? MAX_CAP : (size_type)want;
+    if (new_cap < needed_cap) {
+        new_cap = needed_cap;
+    }
+    Header* h = GET_HEADER();
+    if (alloc.data == (char*)(h + 1) && alloc.len >= cap / 2
+    && !(h->alloc_size & (MAPPED | ADOPTED))
+    && refcnt() == 1 && movableHeader(h)) {
+        alloc.data = reallocNonSubstringWithFooter(alloc.data, cap, new_cap);
+        setAllocCap(new_cap);
+        GET_HEADER()->hash_len.store(0, std::memory_order_relaxed);
+        return true;
+    }
+    char* data = allocWithFooter<size_type>(new_cap);
+    memcpy(data, alloc.data, alloc.len);
+    data[alloc.len] = '\0';
+    decref();
+    alloc.data = data;
+    setAllocCap(new_cap);
+    return true;
+}
+template<typename Traits>
+void basic_string<Traits>::pushSingleton(const char* str, size_type len) {
+    COUNT(appends_in_place, 1);
     ensureSpaceFor(len);
     if (ssoActive()) {
         int sso_len = getSsoLen();
@@ -391,14 +1276,16 @@ void string::pushSingleton(const char* str, u32 len) {
         SSO_DATA[new_len] = '\0';
         setSsoLen(new_len);
     } else {
-        u32 alloc_len = alloc.len;
+        size_type alloc_len = alloc.len;
         memcpy(alloc.data+alloc_len, str, len);
-        u32 new_len = alloc_len + len;
+        size_type new_len = alloc_len + len;
         alloc.data[new_len] = '\0';
         alloc.len = new_len;
     }
 }
-void string::pushSingletonChar(int val) {
+template<typename Traits>
+void basic_string<Traits>::pushSingletonChar(int val) {
+    COUNT(appends_in_place, 1);
     ensureSpaceFor(1);
     if (ssoActive()) {
         int sso_len = getSsoLen();
@@ -406,44 +1293,90 @@ void string::pushSingletonChar(int val) {
         SSO_DATA[sso_len+1] = '\0';
         setSsoLen(sso_len + 1);
     } else {
-        u32 alloc_len = alloc.len;
+        size_type alloc_len = alloc.len;
         alloc.data[alloc_len] = val;
         alloc.data[alloc_len+1] = '\0';
-        alloc.len = alloc_len;
+        alloc.len = alloc_len + 1;
     }
 }
-bool string::isSingleton() const {
+// For writers that filled the room ensureSpaceFor() made themselves.
+template<typename Traits>
+void basic_string<Traits>::setLength(size_type len) {
+    if (ssoActive()) {
+        SSO_DATA[len] = '\0';
+        setSsoLen(len);
+    } else {
+        alloc.data[len] = '\0';
+        alloc.len = len;
+    }
+}
+// Appending to a buffer others can see means copying it.
+template<typename Traits>
+void basic_string<Traits>::pushShared(const char* str, size_type len) {
+    COUNT(appends_copied, 1);
+    *this = basic_string(data(), str, length(), len);
+}
+template<typename Traits>
+bool basic_string<Traits>::isSingleton() const {
     return ssoActive()
         || (allocActive() && refcnt() == 1);
 }
 
-string string::substring(u32 start) const {
-    return string(this, start, length());
+/* The text, if we may change it where it is: it is inline, or we
+ * hold the only reference to a heap buffer that is not interned
+ * (equality compares those by pointer), mapped or adopted. Returns
+ * nullptr otherwise. The header's cached hash is dropped, since the
+ * caller is about to change the bytes it covers. */
+template<typename Traits>
+char* basic_string<Traits>::writableData() {
+    if (ssoActive()) {
+        return SSO_DATA;
+    }
+    if (!allocActive() || refcnt() != 1) {
+        return nullptr;
+    }
+    Header* h = GET_HEADER();
+    if ((h->alloc_size & (MAPPED | ADOPTED))
+    || h->owner.load(std::memory_order_relaxed) == INTERNED) {
+        return nullptr;
+    }
+    h->hash_len.store(0, std::memory_order_relaxed);
+    return alloc.data;
 }
-string string::substring(u32 start, u32 end) const {
-    return string(this, start, end);
+
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::substring(size_type start) const {
+    return basic_string(this, start, length());
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::substring(size_type start, size_type end) const {
+    return basic_string(this, start, end);
 }
 
-void string::shrinkNonSubstringToFitLength(u32 len) {
+template<typename Traits>
+void basic_string<Traits>::shrinkNonSubstringToFitLength(size_type len) {
     if (len <= SSO_CAP) {
         if (!ssoActive()) {
             char* alloc_data = alloc.data;
+            size_type alloc_cap = getAllocCap();
             memcpy(
                 SSO_DATA, 
                 alloc_data,
                 len
             );
             SSO_DATA[len] = '\0';
-            free(alloc_data - sizeof(refc_t));
+            freeNonSubstringWithFooter(alloc_data, alloc_cap);
         }
         setSsoLen(len);
         return;
     }
 
     alloc.data = reallocNonSubstringWithFooter(
-        alloc.data, len
+        alloc.data, getAllocCap(), len
     );
     alloc.data[len] = '\0';
     alloc.len = len;
     setAllocCap(len);
-}
\ No newline at end of file
+}
+
+INSTANTIATE_STRINGS
@@ -1,24 +1,60 @@
 #include "string.hpp"
+typedef uint64_t u64;
 typedef uint32_t u32;
+typedef uint8_t u8;
 
-inline static u32 powU32(u32 a, u32 b) {
-   u32 p = 1;
-   while (b) {
-       if ((b&1) != 0) {
-           p *= a;
-       }
-       b >>= 1;
-       a *= a;
-   }
-   return p;
+// Horner's rule, so O(n) with one multiply-add per byte.
+u32 string_base::javaHashBytes(const char* data, u64 n) {
+    u32 hash = 0;
+    for (u64 i = 0; i < n; i++) {
+        hash = hash * 31 + data[i];
+    }
+    return hash;
 }
 
-u32 string::hashCode() const {
-    u32 n = length();
-    u32 pwr = n-1;
-    u32 hash = 0;
-    for (size_t i = 0; i < n; i++, pwr--) {
-        hash += (*this)[i] * powU32(31, pwr);
+/* Heap strings remember their unseeded hash64() in the allocation
+ * header, so hashing the same key again is O(1). The first length
+ * hashed claims the slot; after that only a uniquely referenced
+ * string (which nobody else can be reading) may replace it. SSO and
+ * literal strings have no header and are hashed every time, as are
+ * string64 contents of 4 GB or more. */
+#define CLAIMED UINT32_MAX
+template<typename Traits>
+u64 basic_string<Traits>::hash64(u64 seed) const {
+    size_type n = length();
+    if (seed != 0) {
+        return hashBytes(data(), n, seed);
+    }
+    HashCache cache = hashCache();
+    if (!cache.len || n >= CLAIMED) {
+        return hashBytes(data(), n, 0);
+    }
+    u32 cached_len = cache.len->load(std::memory_order_acquire);
+    if (cached_len == n) {
+        return cache.hash->load(std::memory_order_relaxed);
+    }
+    u64 hash = hashBytes(data(), n, 0);
+    if (cached_len == 0 || refcnt() == 1) {
+        if (cache.len->compare_exchange_strong(
+            cached_len, CLAIMED, std::memory_order_relaxed
+        )) {
+            cache.hash->store(hash, std::memory_order_relaxed);
+            cache.len->store((u32)n, std::memory_order_release);
+        }
     }
     return hash;
-}
\ No newline at end of file
+}
+#undef CLAIMED
+
+template<typename Traits>
+u32 basic_string<Traits>::hashCode() const {
+    u64 hash = hash64();
+    return (u32)(hash ^ (hash >> 32));
+}
+
+template<typename Traits>
+u32 basic_string<Traits>::javaHashCode() const {
+    return javaHashBytes(data(), length());
+}
+
+INSTANTIATE_STRINGS
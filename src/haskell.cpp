@@ -6,27 +6,33 @@
     string take(uint32_t);*/
 
 #include "string.hpp"
-typedef uint32_t u32;
-string string::drop(u32 n) const {
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::drop(size_type n) const {
     if (n >= length()) {
         return "";
     }
     return substring(n, length());
 }
-char string::head() const {
+template<typename Traits>
+char basic_string<Traits>::head() const {
     return data()[0];
 }
-string string::init() const {
-    u32 len = length();
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::init() const {
+    size_type len = length();
     if (!len) {
         return *this;
     }
     return substring(0, len-1);
 }
-char string::last() const {
-    u32 len = length();
+template<typename Traits>
+char basic_string<Traits>::last() const {
+    size_type len = length();
     if (!len) {
         return 0;
     }
     return (*this)[length()-1];
 }
+
+
+INSTANTIATE_STRINGS
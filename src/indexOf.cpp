@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "string.hpp"
 
 //#define Py_DEBUG
 
@@ -28,8 +29,10 @@
 #endif
 #define _Py_ALIGN_DOWN(x, y) x
 #define STRINGLIB_SIZEOF_CHAR 1
-#define STRINGLIB_FAST_MEMCHR memchr
-typedef int32_t Py_ssize_t;
+#define STRINGLIB_FAST_MEMCHR string_base::findByte
+#define STRINGLIB_FAST_MEMRCHR string_base::rfindByte
+#define STRINGLIB_FAST_COUNT string_base::countByte
+typedef int64_t Py_ssize_t;
 #define Py_MAX(a, b) ((a) > (b)) ? (a) : (b)
 #define Py_MIN(a, b) ((a) < (b)) ? (a) : (b)
 #ifdef __cplusplus
@@ -45,74 +48,179 @@ typedef int32_t Py_ssize_t;
 #  define Py_SAFE_DOWNCAST(VALUE, WIDE, NARROW) _Py_STATIC_CAST(NARROW, (VALUE))
 #endif
 #include "lib/fastsearch.h"
-#include "string.hpp"
-
-typedef uint32_t u32;
-typedef int32_t i32;
 
-i32 string::indexOfInternal(const char* str, u32 str_len) const {
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::indexOfInternal(const char* str, size_type str_len) const {
+    if (str_len >= 2 && str_len <= SHORT_NEEDLE) {
+        const char* s = data();
+        const char* p = findShort(s, length(), str, str_len);
+        return p ? p - s : -1;
+    }
     return FASTSEARCH(
         data(), length(), 
         str, str_len, 
         1, FAST_SEARCH
     );
 }
-i32 string::indexOf(char ch) const {
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::indexOf(char ch) const {
     return find_char(data(), length(), ch);
 }
-i32 string::indexOf(char32_t cp) const {
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::indexOf(char32_t cp) const {
     char buf[5];
     return indexOfInternal(
         buf, cp2utf8(buf, cp)
     );
 }
-i32 string::lastIndexOfInternal(const char* str, u32 str_len) const {
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::lastIndexOfInternal(const char* str, size_type str_len) const {
+    if (str_len >= 2 && str_len <= SHORT_NEEDLE) {
+        const char* s = data();
+        const char* p = rfindShort(s, length(), str, str_len);
+        return p ? p - s : -1;
+    }
     return FASTSEARCH(
         data(), length(),
         str, str_len,
         1, FAST_RSEARCH
     );
 }
-i32 string::lastIndexOf(char ch) const {
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::lastIndexOf(char ch) const {
     return rfind_char(data(), length(), ch);
 }
-i32 string::lastIndexOf(char32_t cp) const {
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::lastIndexOf(char32_t cp) const {
     char buf[5];
     return lastIndexOfInternal(
         buf, cp2utf8(buf, cp)
     );
 }
 
-u32 string::countOfInternal(const char* str, uint32_t str_len) const {
-    return FASTSEARCH(
+template<typename Traits>
+typename basic_string<Traits>::size_type basic_string<Traits>::countOfInternal(const char* str, size_type str_len) const {
+    if (str_len >= 2 && str_len <= SHORT_NEEDLE) {
+        const char* s = data();
+        const char* e = s + length();
+        size_type count = 0;
+        // matches don't overlap, as with FAST_COUNT
+        while ((s = findShort(s, e - s, str, str_len))) {
+            count++;
+            s += str_len;
+        }
+        return count;
+    }
+    // -1 when the needle can't fit
+    int64_t count = FASTSEARCH(
         data(), length(),
         str, str_len,
-        INT32_MAX, FAST_COUNT
+        INT64_MAX, FAST_COUNT
     );
+    return count < 0 ? 0 : count;
 }
-u32 string::countOf(char ch) const {
-    const char* s = data();
-    const char* e = s+length();
-    u32 count = 0;
-    while (s < e) {
-        if (*s == ch) {
-            count++;
-        }
-        s++;
-    }
-    return count;
+template<typename Traits>
+typename basic_string<Traits>::size_type basic_string<Traits>::countOf(char ch) const {
+    return countByte(data(), ch, length());
 }
-u32 string::countOf(char32_t cp) const {
+template<typename Traits>
+typename basic_string<Traits>::size_type basic_string<Traits>::countOf(char32_t cp) const {
     char buf[5];
     return countOfInternal(
         buf, cp2utf8(buf, cp)
     );
 }
 
+/* Finder and RFinder keep the results of fastsearch's setup and
+ * rebuild its structs from them for each search. */
+string_base::Finder::Finder(const string& needle)
+    : pattern(needle), cut(0), period(0), gap(0), periodic(false), table() {
+    uint64_t m = pattern.length();
+    if (m > SHORT_NEEDLE) {
+        prework pre;
+        _preprocess(pattern.data(), m, &pre);
+        cut = pre.cut;
+        period = pre.period;
+        gap = pre.gap;
+        periodic = pre.is_periodic;
+        memcpy(table, pre.table, sizeof(table));
+    }
+}
+const char* string_base::Finder::first(const char* hay, uint64_t len) const {
+    uint64_t m = pattern.length();
+    if (m == 0) {
+        return nullptr;
+    }
+    if (m == 1) {
+        return findByte(hay, pattern[0], len);
+    }
+    if (m <= SHORT_NEEDLE) {
+        return findShort(hay, len, pattern.data(), m);
+    }
+    prework pre;
+    pre.needle = pattern.data();
+    pre.len_needle = m;
+    pre.cut = cut;
+    pre.period = period;
+    pre.gap = gap;
+    pre.is_periodic = periodic;
+    memcpy(pre.table, table, sizeof(table));
+    int64_t i = _two_way(hay, len, &pre);
+    return i < 0 ? nullptr : hay + i;
+}
+int64_t string_base::Finder::find(const char* hay, uint64_t len, uint64_t from) const {
+    if (from > len) {
+        return -1;
+    }
+    const char* p = first(hay + from, len - from);
+    return p ? p - hay : -1;
+}
+uint64_t string_base::Finder::count(const char* hay, uint64_t len) const {
+    const char* e = hay + len;
+    uint64_t count = 0;
+    while ((hay = first(hay, e - hay))) {
+        count++;
+        hay += pattern.length();
+    }
+    return count;
+}
+void string_base::Finder::findAll(const char* hay, uint64_t len, std::vector<uint64_t>& out) const {
+    out.clear();
+    const char* s = hay;
+    const char* e = hay + len;
+    while ((s = first(s, e - s))) {
+        out.push_back(s - hay);
+        s += pattern.length();
+    }
+}
+
+string_base::RFinder::RFinder(const string& needle)
+    : pattern(needle), mask(0), skip(0) {
+    uint64_t m = pattern.length();
+    if (m > SHORT_NEEDLE) {
+        default_rfind_prepare(pattern.data(), m, &mask, &skip);
+    }
+}
+int64_t string_base::RFinder::rfind(const char* hay, uint64_t end) const {
+    uint64_t m = pattern.length();
+    const char* p;
+    if (m == 0 || end < m) {
+        return -1;
+    }
+    if (m == 1) {
+        p = rfindByte(hay, pattern[0], end);
+    } else if (m <= SHORT_NEEDLE) {
+        p = rfindShort(hay, end, pattern.data(), m);
+    } else {
+        return default_rfind_prepared(hay, end, pattern.data(), m, mask, skip);
+    }
+    return p ? p - hay : -1;
+}
+
 /* static */
-int32_t string::stringlib_count(
-    const char* hay, int32_t hlen, 
-    const char* needle, int32_t nlen, int32_t maxcount
+int64_t string_base::stringlib_count(
+    const char* hay, int64_t hlen, 
+    const char* needle, int64_t nlen, int64_t maxcount
 ) {
     return FASTSEARCH(
         hay, hlen, needle, 
@@ -121,13 +229,15 @@ int32_t string::stringlib_count(
 }
 
 /* static */
-int32_t string::stringlib_find(
-    const char* hay, int32_t hlen,
-    const char* needle, int32_t nlen,
-    int32_t maxcount
+int64_t string_base::stringlib_find(
+    const char* hay, int64_t hlen,
+    const char* needle, int64_t nlen,
+    int64_t maxcount
 ) {
     return FASTSEARCH(
         hay, hlen, needle,
         nlen, maxcount, FAST_SEARCH
     );
-}
\ No newline at end of file
+}
+
+INSTANTIATE_STRINGS
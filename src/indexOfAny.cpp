@@ -0,0 +1,409 @@
+#include "string.hpp"
+#include <algorithm>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+typedef string_base::MultiFinder MultiFinder;
+typedef MultiFinder::Match Match;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TEDDY
+#include <immintrin.h>
+#endif
+
+/* Teddy comes from Hyperscan; this follows the description in Rust's
+ * aho-corasick crate. The needles are spread over 8 buckets. For each
+ * of their first FINGERPRINT bytes, two 16-entry tables map the low
+ * and the high nibble of a byte to the buckets with a needle that has
+ * such a nibble there. pshufb looks up 32 haystack bytes at once, and
+ * ANDing the lookups leaves, for each position, the buckets that may
+ * have a needle starting there; their needles are then compared in
+ * full. Positions come out in order, so the first verified one is the
+ * leftmost match. */
+#define TEDDY_MAX 64
+#define BUCKETS 8
+#define FINGERPRINT 3
+
+/* Aho-Corasick runs as a DFA. Bytes that play the same part in every
+ * needle (above all, bytes in none of them) share a class, which keeps
+ * the transition table to states x classes. It reports matches by
+ * where they end, so finding the leftmost one carries on for up to
+ * the longest needle's length after the first. */
+struct MultiFinder::Tables {
+    std::vector<string> needles;
+    // of needles, which the scans would otherwise fetch once per candidate
+    std::vector<const char*> strs;
+    std::vector<u64> lens;
+    u64 max_len;
+    bool teddy;
+    int fingerprint;
+    u8 masks[FINGERPRINT][2][16];
+    std::vector<u32> buckets[BUCKETS];
+    u16 classes[256];
+    u32 class_count;
+    std::vector<u32> next; // [state * class_count + class]
+    // needles ending in state s are out[out_begin[s]] to out[out_begin[s + 1] - 1]
+    std::vector<u32> out_begin;
+    std::vector<u32> out;
+
+    u64 length(u32 k) const {
+        return lens[k];
+    }
+    bool matchesAt(const char* hay, u64 len, u64 pos, u32 k) const {
+        u64 m = lens[k];
+        return pos + m <= len && memcmp(hay + pos, strs[k], m) == 0;
+    }
+    void buildTeddy();
+    void buildAutomaton();
+    // f(start, needle) for every match, until it returns false.
+    template<typename F> void each(const char* hay, u64 len, F f) const;
+    template<typename F> void eachAutomaton(const char* hay, u64 len, F f) const;
+#ifdef TEDDY
+    template<typename F> __attribute__((target("avx2")))
+    void eachTeddy(const char* hay, u64 len, F f) const;
+#endif
+    Match findAutomaton(const char* hay, u64 len) const;
+};
+
+void MultiFinder::Tables::buildTeddy() {
+    std::vector<u32> order;
+    u64 min_len = UINT64_MAX;
+    for (u32 k = 0; k < needles.size(); k++) {
+        if (length(k) != 0) {
+            order.push_back(k);
+            min_len = std::min(min_len, length(k));
+        }
+    }
+    fingerprint = (int)std::min<u64>(min_len, FINGERPRINT);
+    // Needles with the same first bytes share a bucket, so that a
+    // candidate costs fewer compares, and the distinct first bytes
+    // are spread evenly: with up to 8 of them the filter is exact.
+    std::sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+        return memcmp(strs[a], strs[b], fingerprint) < 0;
+    });
+    std::vector<u32> group(order.size(), 0);
+    for (u64 i = 1; i < order.size(); i++) {
+        group[i] = group[i - 1] + (memcmp(strs[order[i - 1]], strs[order[i]], fingerprint) != 0);
+    }
+    u64 groups = group.back() + 1;
+    memset(masks, 0, sizeof(masks));
+    for (u64 i = 0; i < order.size(); i++) {
+        u32 k = order[i];
+        u32 b = group[i] * BUCKETS / groups;
+        buckets[b].push_back(k);
+        for (int j = 0; j < fingerprint; j++) {
+            u8 c = strs[k][j];
+            masks[j][0][c & 15] |= 1 << b;
+            masks[j][1][c >> 4] |= 1 << b;
+        }
+    }
+}
+
+void MultiFinder::Tables::buildAutomaton() {
+    // two bytes share a class when no needle tells them apart
+    memset(classes, 0, sizeof(classes));
+    class_count = 1;
+    for (const string& s : needles) {
+        for (u64 i = 0; i < s.length(); i++) {
+            u8 c = s.data()[i];
+            if (!classes[c]) {
+                classes[c] = class_count++;
+            }
+        }
+    }
+    u32 C = class_count;
+    // the trie, where 0 (the root) also stands for no edge
+    std::vector<u32> trie(C, 0);
+    std::vector<std::vector<u32>> ends(1);
+    for (u32 k = 0; k < needles.size(); k++) {
+        if (length(k) == 0) {
+            continue;
+        }
+        u32 s = 0;
+        for (u64 i = 0; i < length(k); i++) {
+            u32 c = classes[(u8)strs[k][i]];
+            if (!trie[s * C + c]) {
+                trie[s * C + c] = (u32)ends.size();
+                ends.emplace_back();
+                trie.resize(ends.size() * C, 0);
+            }
+            s = trie[s * C + c];
+        }
+        ends[s].push_back(k);
+    }
+    // Breadth first, each state's failure state is shallower and
+    // already complete, so its transitions fill in the missing ones.
+    u32 states = (u32)ends.size();
+    next = trie;
+    std::vector<u32> fail(states, 0);
+    std::vector<u32> queue;
+    for (u32 c = 0; c < C; c++) {
+        if (trie[c]) {
+            queue.push_back(trie[c]);
+        }
+    }
+    for (u64 q = 0; q < queue.size(); q++) {
+        u32 s = queue[q];
+        for (u32 c = 0; c < C; c++) {
+            u32 t = trie[s * C + c];
+            if (t) {
+                fail[t] = next[fail[s] * C + c];
+                queue.push_back(t);
+            } else {
+                next[s * C + c] = next[fail[s] * C + c];
+            }
+        }
+    }
+    // a state also reports everything its failure state does
+    std::vector<std::vector<u32>> outs(states);
+    for (u32 s : queue) {
+        outs[s] = ends[s];
+        outs[s].insert(outs[s].end(), outs[fail[s]].begin(), outs[fail[s]].end());
+    }
+    out_begin.assign(states + 1, 0);
+    for (u32 s = 0; s < states; s++) {
+        out_begin[s + 1] = out_begin[s] + (u32)outs[s].size();
+        out.insert(out.end(), outs[s].begin(), outs[s].end());
+    }
+}
+
+template<typename F>
+void MultiFinder::Tables::eachAutomaton(const char* hay, u64 len, F f) const {
+    u32 s = 0;
+    for (u64 i = 0; i < len; i++) {
+        s = next[s * class_count + classes[(u8)hay[i]]];
+        for (u32 o = out_begin[s]; o < out_begin[s + 1]; o++) {
+            u32 k = out[o];
+            if (!f(i + 1 - length(k), k)) {
+                return;
+            }
+        }
+    }
+}
+
+Match MultiFinder::Tables::findAutomaton(const char* hay, u64 len) const {
+    Match best = {-1, 0};
+    u64 limit = len;
+    u32 s = 0;
+    for (u64 i = 0; i < limit; i++) {
+        s = next[s * class_count + classes[(u8)hay[i]]];
+        for (u32 o = out_begin[s]; o < out_begin[s + 1]; o++) {
+            u32 k = out[o];
+            int64_t start = i + 1 - length(k);
+            if (best.start < 0 || start < best.start
+            || (start == best.start && length(k) > length(best.needle))
+            || (start == best.start && length(k) == length(best.needle) && k < best.needle)) {
+                best = {start, k};
+                // a match ending after this can't start at or before best.start
+                limit = std::min(len, best.start + max_len);
+            }
+        }
+    }
+    return best;
+}
+
+#ifdef TEDDY
+template<typename F> __attribute__((target("avx2")))
+void MultiFinder::Tables::eachTeddy(const char* hay, u64 len, F f) const {
+    __m256i lo[FINGERPRINT], hi[FINGERPRINT];
+    for (int j = 0; j < fingerprint; j++) {
+        lo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)masks[j][0]));
+        hi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)masks[j][1]));
+    }
+    const __m256i nibble = _mm256_set1_epi8(15);
+    // the last block is copied here, so that no load runs past the haystack
+    char tail[32 + FINGERPRINT] = {};
+    u8 found[32];
+    for (u64 i = 0; i < len; i += 32) {
+        const char* p = hay + i;
+        if (i + 32 + fingerprint - 1 > len) {
+            memcpy(tail, p, len - i);
+            p = tail;
+        }
+        __m256i cand = _mm256_set1_epi8(-1);
+        for (int j = 0; j < fingerprint; j++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + j));
+            __m256i l = _mm256_shuffle_epi8(lo[j], _mm256_and_si256(v, nibble));
+            __m256i h = _mm256_shuffle_epi8(hi[j], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            cand = _mm256_and_si256(cand, _mm256_and_si256(l, h));
+        }
+        u32 mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(cand, _mm256_setzero_si256()));
+        if (!mask) {
+            continue;
+        }
+        _mm256_storeu_si256((__m256i*)found, cand);
+        // the compares below run SSE code in libc
+        _mm256_zeroupper();
+        for (; mask; mask &= mask - 1) {
+            int b = __builtin_ctz(mask);
+            u64 pos = i + b;
+            for (u32 bits = found[b]; bits; bits &= bits - 1) {
+                for (u32 k : buckets[__builtin_ctz(bits)]) {
+                    if (matchesAt(hay, len, pos, k) && !f(pos, k)) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+    _mm256_zeroupper();
+}
+#endif
+
+template<typename F>
+void MultiFinder::Tables::each(const char* hay, u64 len, F f) const {
+#ifdef TEDDY
+    if (teddy) {
+        eachTeddy(hay, len, f);
+        return;
+    }
+#endif
+    eachAutomaton(hay, len, f);
+}
+
+void MultiFinder::build(const std::vector<string>& needles) {
+    Tables* t = new Tables();
+    t->needles = needles;
+    t->max_len = 0;
+    u64 nonempty = 0;
+    for (const string& s : t->needles) {
+        t->strs.push_back(s.data());
+        t->lens.push_back(s.length());
+        t->max_len = std::max<u64>(t->max_len, s.length());
+        nonempty += s.length() != 0;
+    }
+    t->teddy = false;
+#ifdef TEDDY
+    t->teddy = nonempty != 0 && nonempty <= TEDDY_MAX && scanLevel() >= SCAN_AVX2;
+#endif
+    if (t->teddy) {
+        t->buildTeddy();
+    } else {
+        t->buildAutomaton();
+    }
+    tables.reset(t);
+}
+
+size_t MultiFinder::size() const {
+    return tables->needles.size();
+}
+const string& MultiFinder::needle(size_t i) const {
+    return tables->needles[i];
+}
+
+Match MultiFinder::find(const char* hay, u64 len) const {
+    const Tables& t = *tables;
+    if (!t.teddy) {
+        return t.findAutomaton(hay, len);
+    }
+    // Teddy reports every match at one position before the next
+    Match best = {-1, 0};
+    t.each(hay, len, [&](u64 start, u32 k) {
+        if (best.start >= 0 && (int64_t)start > best.start) {
+            return false;
+        }
+        if (best.start < 0 || t.length(k) > t.length(best.needle)
+        || (t.length(k) == t.length(best.needle) && k < best.needle)) {
+            best = {(int64_t)start, k};
+        }
+        return true;
+    });
+    return best;
+}
+
+void MultiFinder::findAll(const char* hay, u64 len, std::vector<Match>& out) const {
+    out.clear();
+    tables->each(hay, len, [&](u64 start, u32 k) {
+        out.push_back({(int64_t)start, k});
+        return true;
+    });
+    std::sort(out.begin(), out.end(), [](const Match& a, const Match& b) {
+        return a.start != b.start ? a.start < b.start : a.needle < b.needle;
+    });
+}
+
+void MultiFinder::findSuccessive(const char* hay, u64 len, std::vector<Match>& out) const {
+    const Tables& t = *tables;
+    out.clear();
+    if (!t.teddy) {
+        for (u64 pos = 0; pos < len;) {
+            Match m = t.findAutomaton(hay + pos, len - pos);
+            if (m.start < 0) {
+                break;
+            }
+            m.start += pos;
+            out.push_back(m);
+            pos = m.start + t.length(m.needle);
+        }
+        return;
+    }
+    // Teddy goes by start, so a start's longest match is known once the next start comes
+    Match best = {-1, 0};
+    u64 free_from = 0;
+    t.each(hay, len, [&](u64 start, u32 k) {
+        if ((int64_t)start != best.start) {
+            if (best.start >= 0) {
+                out.push_back(best);
+                free_from = best.start + t.length(best.needle);
+                best.start = -1;
+            }
+            if (start < free_from) {
+                return true;
+            }
+            best = {(int64_t)start, k};
+        } else if (t.length(k) > t.length(best.needle)
+        || (t.length(k) == t.length(best.needle) && k < best.needle)) {
+            best.needle = k;
+        }
+        return true;
+    });
+    if (best.start >= 0) {
+        out.push_back(best);
+    }
+}
+
+/* Both engines report a needle's matches in order, so skipping those
+ * that overlap the last one counted is countOf()'s greedy count. */
+void MultiFinder::countEach(const char* hay, u64 len, std::vector<uint64_t>& counts) const {
+    const Tables& t = *tables;
+    counts.assign(t.needles.size(), 0);
+    std::vector<u64> free_from(t.needles.size(), 0);
+    t.each(hay, len, [&](u64 start, u32 k) {
+        if (start >= free_from[k]) {
+            counts[k]++;
+            free_from[k] = start + t.length(k);
+        }
+        return true;
+    });
+}
+
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::indexOfAny(const MultiFinder& needles) const {
+    return needles.find(data(), length()).start;
+}
+template<typename Traits>
+typename basic_string<Traits>::ssize_type basic_string<Traits>::indexOfAny(const std::vector<basic_string>& needles) const {
+    return indexOfAny(MultiFinder(needles));
+}
+template<typename Traits>
+bool basic_string<Traits>::includesAny(const MultiFinder& needles) const {
+    return needles.find(data(), length()).start >= 0;
+}
+template<typename Traits>
+bool basic_string<Traits>::includesAny(const std::vector<basic_string>& needles) const {
+    return includesAny(MultiFinder(needles));
+}
+template<typename Traits>
+std::vector<typename basic_string<Traits>::size_type> basic_string<Traits>::countOfEach(const MultiFinder& needles) const {
+    std::vector<uint64_t> counts;
+    needles.countEach(data(), length(), counts);
+    return std::vector<size_type>(counts.begin(), counts.end());
+}
+template<typename Traits>
+std::vector<typename basic_string<Traits>::size_type> basic_string<Traits>::countOfEach(const std::vector<basic_string>& needles) const {
+    return countOfEach(MultiFinder(needles));
+}
+
+INSTANTIATE_STRINGS
@@ -0,0 +1,148 @@
+#include "string.hpp"
+#include <mutex>
+
+typedef uint64_t u64;
+typedef string_base::InternStats InternStats;
+
+/* The intern table is split into shards by the top bits of hash64(),
+ * each an open-addressing table behind its own lock, so threads
+ * interning different names rarely meet. Entries hold a reference,
+ * so a canonical string stays put until evictInterned() finds that
+ * nobody else holds it. There is one table per flavor. */
+#define SHARD_BITS 6
+#define SHARDS (1 << SHARD_BITS)
+#define MIN_SLOTS 16
+
+template<typename S> struct InternSlot {
+    u64 hash;
+    S str; // empty when the slot is free
+};
+template<typename S> struct InternShard {
+    std::mutex lock;
+    InternSlot<S>* slots;
+    u64 mask;
+    u64 used;
+    InternStats stats;
+};
+/* Never destroyed: strings interned by static destructors in other
+ * files must still find it. */
+template<typename S> struct InternTable {
+    InternShard<S> shards[SHARDS];
+};
+template<typename S> static InternTable<S>& internTable() {
+    static InternTable<S>* table = new InternTable<S>();
+    return *table;
+}
+
+template<typename S> static void insertSlot(InternShard<S>& sh, u64 hash, S&& str) {
+    u64 i = hash & sh.mask;
+    while (sh.slots[i].str.length() != 0) {
+        i = (i + 1) & sh.mask;
+    }
+    sh.slots[i].hash = hash;
+    sh.slots[i].str = std::move(str);
+}
+// Rebuilds the shard with n slots, keeping the entries keep() accepts.
+template<typename S, typename F> static void rebuildShard(InternShard<S>& sh, u64 n, F keep) {
+    InternSlot<S>* old = sh.slots;
+    u64 old_n = old ? sh.mask + 1 : 0;
+    sh.slots = new InternSlot<S>[n]();
+    sh.mask = n - 1;
+    sh.used = 0;
+    for (u64 i = 0; i < old_n; i++) {
+        if (old[i].str.length() != 0 && keep(old[i].str)) {
+            insertSlot(sh, old[i].hash, std::move(old[i].str));
+            sh.used++;
+        }
+    }
+    delete[] old;
+}
+
+template<typename Traits>
+basic_string<typename Traits::shared_traits> basic_string<Traits>::intern() const {
+    typedef basic_string<typename Traits::shared_traits> shared_string;
+    size_type len = length();
+    const char* str = data();
+    if (isInterned()) {
+        return share();
+    }
+    if (len < sizeof(alloc)) {
+        return shared_string(str, len);
+    }
+    u64 hash = hash64();
+    InternShard<shared_string>& sh =
+        internTable<shared_string>().shards[hash >> (64 - SHARD_BITS)];
+    std::lock_guard<std::mutex> guard(sh.lock);
+    sh.stats.lookups++;
+    if (sh.slots) {
+        for (u64 i = hash & sh.mask; sh.slots[i].str.length() != 0; i = (i + 1) & sh.mask) {
+            const shared_string& entry = sh.slots[i].str;
+            if (sh.slots[i].hash == hash && entry.length() == len
+            && memcmp(entry.data(), str, len) == 0) {
+                sh.stats.hits++;
+                sh.stats.bytes_saved += len;
+                return entry;
+            }
+        }
+    }
+    // at most half full
+    if (!sh.slots || (sh.used + 1) * 2 > sh.mask + 1) {
+        u64 n = sh.slots ? (sh.mask + 1) * 2 : MIN_SLOTS;
+        rebuildShard(sh, n, [](const shared_string&) { return true; });
+    }
+    shared_string canonical(str, len);
+    canonical.markInterned();
+    shared_string res = canonical;
+    insertSlot(sh, hash, std::move(canonical));
+    sh.used++;
+    sh.stats.entries++;
+    sh.stats.bytes += len;
+    return res;
+}
+
+template<typename Traits>
+InternStats basic_string<Traits>::internStats() {
+    typedef basic_string<typename Traits::shared_traits> shared_string;
+    InternTable<shared_string>& table = internTable<shared_string>();
+    InternStats total = {};
+    for (int i = 0; i < SHARDS; i++) {
+        InternShard<shared_string>& sh = table.shards[i];
+        std::lock_guard<std::mutex> guard(sh.lock);
+        total.entries += sh.stats.entries;
+        total.bytes += sh.stats.bytes;
+        total.lookups += sh.stats.lookups;
+        total.hits += sh.stats.hits;
+        total.bytes_saved += sh.stats.bytes_saved;
+    }
+    return total;
+}
+
+/* Interned strings are counted exactly from any thread, and new
+ * references only come from the table while its lock is held, so a
+ * count of one really is just the table. */
+template<typename Traits>
+uint64_t basic_string<Traits>::evictInterned() {
+    typedef basic_string<typename Traits::shared_traits> shared_string;
+    InternTable<shared_string>& table = internTable<shared_string>();
+    u64 evicted = 0;
+    for (int i = 0; i < SHARDS; i++) {
+        InternShard<shared_string>& sh = table.shards[i];
+        std::lock_guard<std::mutex> guard(sh.lock);
+        if (!sh.slots) {
+            continue;
+        }
+        u64 n = sh.mask + 1;
+        rebuildShard(sh, n, [&](const shared_string& s) {
+            if (s.refcnt() > 1) {
+                return true;
+            }
+            evicted++;
+            sh.stats.entries--;
+            sh.stats.bytes -= s.length();
+            return false;
+        });
+    }
+    return evicted;
+}
+
+INSTANTIATE_STRINGS
@@ -119,7 +119,14 @@ Py_LOCAL_INLINE(Py_ssize_t)
 STRINGLIB(rfind_char)(const STRINGLIB_CHAR* s, Py_ssize_t n, STRINGLIB_CHAR ch)
 {
     const STRINGLIB_CHAR *p;
-#ifdef HAVE_MEMRCHR
+#ifdef STRINGLIB_FAST_MEMRCHR
+    if (n > MEMRCHR_CUT_OFF) {
+        p = (const char*)STRINGLIB_FAST_MEMRCHR(s, ch, n);
+        if (p != NULL)
+            return (p - s);
+        return -1;
+    }
+#elif defined(HAVE_MEMRCHR)
     /* memrchr() is a GNU extension, available since glibc 2.1.91.  it
        doesn't seem as optimized as memchr(), but is still quite
        faster than our hand-written loop below. There is no wmemrchr
@@ -682,15 +689,15 @@ STRINGLIB(adaptive_find)(const STRINGLIB_CHAR* s, Py_ssize_t n,
 }
 
 
-static Py_ssize_t
-STRINGLIB(default_rfind)(const STRINGLIB_CHAR* s, Py_ssize_t n,
-                         const STRINGLIB_CHAR* p, Py_ssize_t m,
-                         Py_ssize_t maxcount, int mode)
+/* default_rfind's setup and search, kept apart so that a caller
+   looking for the same needle in many strings does the setup once. */
+static void
+STRINGLIB(default_rfind_prepare)(const STRINGLIB_CHAR* p, Py_ssize_t m,
+                                 unsigned long* mask_out, Py_ssize_t* skip_out)
 {
     /* create compressed boyer-moore delta 1 table */
     unsigned long mask = 0;
-    Py_ssize_t i, j, mlast = m - 1, skip = m - 1, w = n - m;
-
+    Py_ssize_t i, mlast = m - 1, skip = m - 1;
     /* process pattern[0] outside the loop */
     STRINGLIB_BLOOM_ADD(mask, p[0]);
     /* process pattern[:0:-1] */
@@ -700,6 +707,17 @@ STRINGLIB(default_rfind)(const STRINGLIB_CHAR* s, Py_ssize_t n,
             skip = i - 1;
         }
     }
+    *mask_out = mask;
+    *skip_out = skip;
+}
+
+
+static Py_ssize_t
+STRINGLIB(default_rfind_prepared)(const STRINGLIB_CHAR* s, Py_ssize_t n,
+                                  const STRINGLIB_CHAR* p, Py_ssize_t m,
+                                  unsigned long mask, Py_ssize_t skip)
+{
+    Py_ssize_t i, j, mlast = m - 1, w = n - m;
 
     for (i = w; i >= 0; i--) {
         if (s[i] == p[0]) {
@@ -732,11 +750,27 @@ STRINGLIB(default_rfind)(const STRINGLIB_CHAR* s, Py_ssize_t n,
 }
 
 
+static Py_ssize_t
+STRINGLIB(default_rfind)(const STRINGLIB_CHAR* s, Py_ssize_t n,
+                         const STRINGLIB_CHAR* p, Py_ssize_t m,
+                         Py_ssize_t maxcount, int mode)
+{
+    unsigned long mask;
+    Py_ssize_t skip;
+    STRINGLIB(default_rfind_prepare)(p, m, &mask, &skip);
+    return STRINGLIB(default_rfind_prepared)(s, n, p, m, mask, skip);
+}
+
+
 static inline Py_ssize_t
 STRINGLIB(count_char)(const STRINGLIB_CHAR *s, Py_ssize_t n,
                       const STRINGLIB_CHAR p0, Py_ssize_t maxcount)
 {
     Py_ssize_t i, count = 0;
+#ifdef STRINGLIB_FAST_COUNT
+    if (maxcount >= n)
+        return STRINGLIB_FAST_COUNT(s, p0, n);
+#endif
     for (i = 0; i < n; i++) {
         if (s[i] == p0) {
             count++;
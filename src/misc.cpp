@@ -1,51 +1,86 @@
 #include "string.hpp"
 
-typedef uint32_t u32;
-
-string string::padLeft(u32 max_len, char fill) const {
-    u32 len = length();
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::padLeft(size_type max_len, char fill) const& {
+    size_type len = length();
     if (len >= max_len) {
         return *this;
     }
     return pad(max_len - len, 0, fill);
 }
-string string::padRight(u32 max_len, char fill) const {
-    u32 len = length();
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::padRight(size_type max_len, char fill) const& {
+    size_type len = length();
     if (len >= max_len) {
         return *this;
     }
     return pad(0, max_len - len, fill);
 }
+/* A temporary is padded like an append: in its own spare room if it
+ * is the only reference, with padLeft moving the text up first. */
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::padLeft(size_type max_len, char fill) && {
+    size_type len = length();
+    if (len >= max_len) {
+        return std::move(*this);
+    }
+    if (!writableData()) {
+        return padLeft(max_len, fill);
+    }
+    ensureSpaceFor(max_len - len);
+    char* str = data();
+    memmove(str + (max_len - len), str, len);
+    memset(str, fill, max_len - len);
+    setLength(max_len);
+    return std::move(*this);
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::padRight(size_type max_len, char fill) && {
+    size_type len = length();
+    if (len >= max_len) {
+        return std::move(*this);
+    }
+    if (!isSingleton()) {
+        return padRight(max_len, fill);
+    }
+    ensureSpaceFor(max_len - len);
+    memset(data() + len, fill, max_len - len);
+    setLength(max_len);
+    return std::move(*this);
+}
 
-int64_t string::parseInt() {
+template<typename Traits>
+int64_t basic_string<Traits>::parseInt() {
     return std::strtoll(str(), nullptr, 0);
 }
-float string::parseFloat() {
+template<typename Traits>
+float basic_string<Traits>::parseFloat() {
     return std::strtof(str(), nullptr);
 }
-double string::parseDouble() {
+template<typename Traits>
+double basic_string<Traits>::parseDouble() {
     return std::strtod(str(), nullptr);
 }
-char* string::toCharArray() const {
+template<typename Traits>
+char* basic_string<Traits>::toCharArray() const {
     char* str = data();
-    u32 len = length();
+    size_type len = length();
     char* res = (char*)malloc(len+1);
     memcpy(res, str, len);
     res[len] = '\0';
     return res;
 }
-std::string string::toStl() const {
+template<typename Traits>
+std::string basic_string<Traits>::toStl() const {
     return std::string(data(), length());
 }
-std::vector<char> string::toVec() const {
+template<typename Traits>
+std::vector<char> basic_string<Traits>::toVec() const {
     std::vector<char> vec;
-    u32 slen = length();
+    size_type slen = length();
     vec.reserve(slen);
     memcpy(vec.data(), data(), slen);
     return vec;
 }
 
-std::ostream& operator<<(std::ostream& stream, const string& s) {
-    stream.write(s.data(), s.length());
-    return stream;
-}
\ No newline at end of file
+INSTANTIATE_STRINGS
@@ -1,241 +1,187 @@
 #include "string.hpp"
 #include <stdio.h>
 #include <string.h>
-#include <inttypes.h>
 
-#define I2S_BUFLEN 32
-static int i2s(char* buf, int64_t val) {
-    int slen = sprintf(buf, "%" PRId64, val);
+/* Two digits per division, written from the end, instead of
+ * sprintf's format parsing and locale lookups. */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+/* static */
+int string_base::u2s(char* buf, uint64_t val) {
+    char tmp[20];
+    char* end = tmp + sizeof(tmp);
+    char* p = end;
+    while (val >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + (val % 100) * 2, 2);
+        val /= 100;
+    }
+    if (val >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + val * 2, 2);
+    } else {
+        *--p = '0' + (char)val;
+    }
+    int slen = (int)(end - p);
+    memcpy(buf, p, slen);
+    buf[slen] = '\0';
     return slen;
 }
-#define U2S_BUFLEN I2S_BUFLEN
-static int u2s(char* buf, uint64_t val) {
-    int slen = sprintf(buf, "%" PRIu64, val);
-    return slen;
+/* static */
+int string_base::i2s(char* buf, int64_t val) {
+    if (val < 0) {
+        buf[0] = '-';
+        return 1 + u2s(buf + 1, 0 - (uint64_t)val);
+    }
+    return u2s(buf, val);
 }
-#define D2S_BUFLEN 128
-static int d2s(char* buf, double val) {
+/* static */
+int string_base::d2s(char* buf, double val) {
     int slen = snprintf(buf, D2S_BUFLEN, "%g", val);
-    if (slen >= (int)sizeof(buf)) {
-        slen = sizeof(buf) - 1;
+    if (slen >= D2S_BUFLEN) {
+        slen = D2S_BUFLEN - 1;
         buf[slen] = 0;
     }
     return slen;
 }
 
-string string::operator+(int64_t val) const {
-    char buf[I2S_BUFLEN];
-    return string(
-        data(), buf, 
-        length(), i2s(buf, val)
-    );
-}
-string string::operator+(uint64_t val) const {
-    char buf[U2S_BUFLEN];
-    return string(
-        data(), buf, 
-        length(), u2s(buf, val)
-    );
-}
-string string::operator+(int32_t val) const {
-    return this->operator+((int64_t)val);
-}
-string string::operator+(uint32_t val) const {
-    return this->operator+((uint64_t)val);
-}
-string string::operator+(int16_t val) const {
-    return this->operator+((int64_t)val);
-}
-string string::operator+(uint16_t val) const {
-    return this->operator+((uint64_t)val);
-}
-string string::operator+(int8_t val) const {
-    return this->operator+((int64_t)val);
-}
-string string::operator+(uint8_t val) const {
-    return this->operator+((uint64_t)val);
-}
-string string::operator+(double val) const {
-    char buf[D2S_BUFLEN];
-    return string(
-        data(), buf, 
-        length(), d2s(buf, val)
-    );
-}
-string string::operator+(float val) const {
-    return string::operator+((double)val);
-}
-string string::operator+(char val) const {
-    return string(
-        data(), &val, 
-        length(), 1
-    );
-}
-
-string string::operator+(char32_t cp) const {
+/* static */
+string_base::ConcatBuffer<string_base::I2S_BUFLEN> string_base::concatPart(int64_t val) {
+    ConcatBuffer<I2S_BUFLEN> part;
+    part.len = i2s(part.data, val);
+    return part;
+}
+/* static */
+string_base::ConcatBuffer<string_base::U2S_BUFLEN> string_base::concatPart(uint64_t val) {
+    ConcatBuffer<U2S_BUFLEN> part;
+    part.len = u2s(part.data, val);
+    return part;
+}
+/* static */
+string_base::ConcatBuffer<string_base::D2S_BUFLEN> string_base::concatPart(double val) {
+    ConcatBuffer<D2S_BUFLEN> part;
+    part.len = d2s(part.data, val);
+    return part;
+}
+/* static */
+string_base::ConcatBuffer<1> string_base::concatPart(char val) {
+    ConcatBuffer<1> part;
+    part.data[0] = val;
+    part.len = 1;
+    return part;
+}
+/* static */
+string_base::ConcatBuffer<4> string_base::concatPart(char32_t cp) {
     char buf[5];
-    return string(
-        data(), buf, 
-        length(), cp2utf8(buf, cp)
-    );
+    ConcatBuffer<4> part;
+    part.len = cp2utf8(buf, cp);
+    memcpy(part.data, buf, part.len);
+    return part;
 }
-
-string string::operator+(bool val) const {
+/* static */
+string_base::ConcatView string_base::concatPart(bool val) {
     if (val) {
-        return string::operator+("true");
+        return ConcatView{"true", 4};
     } else {
-        return string::operator+("false");
+        return ConcatView{"false", 5};
     }
 }
 
-void string::operator+=(int64_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(int64_t val) {
     if (isSingleton()) {
         char buf[I2S_BUFLEN];
         pushSingleton(buf, i2s(buf, val));
     } else {
-        *this = *this + val;
+        char buf[I2S_BUFLEN];
+        pushShared(buf, i2s(buf, val));
     }
 }
-void string::operator+=(uint64_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(uint64_t val) {
     if (isSingleton()) {
         char buf[U2S_BUFLEN];
         pushSingleton(buf, u2s(buf, val));
     } else {
-        *this = *this + val;
+        char buf[U2S_BUFLEN];
+        pushShared(buf, u2s(buf, val));
     }
 }
-void string::operator+=(int32_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(int32_t val) {
     this->operator+=((int64_t)val);
 }
-void string::operator+=(uint32_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(uint32_t val) {
     this->operator+=((uint64_t)val);
 }
-void string::operator+=(int16_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(int16_t val) {
     this->operator+=((int64_t)val);
 }
-void string::operator+=(uint16_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(uint16_t val) {
     this->operator+=((uint64_t)val);
 }
-void string::operator+=(int8_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(int8_t val) {
     this->operator+=((int64_t)val);
 }
-void string::operator+=(uint8_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(uint8_t val) {
     this->operator+=((uint64_t)val);
 }
 
-void string::operator+=(double val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(double val) {
     if (isSingleton()) {
         char buf[D2S_BUFLEN];
         pushSingleton(buf, d2s(buf, val));
     } else {
-        *this = *this + val;
+        char buf[D2S_BUFLEN];
+        pushShared(buf, d2s(buf, val));
     }
 }
-void string::operator+=(float val) {
-    return string::operator+=((double)val);
+template<typename Traits>
+void basic_string<Traits>::operator+=(float val) {
+    return basic_string::operator+=((double)val);
 }
-void string::operator+=(char val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(char val) {
     if (isSingleton()) {
         pushSingletonChar(val);
     } else {
-        *this = *this + val;
+        pushShared(&val, 1);
     }
 }
-void string::operator+=(char32_t val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(char32_t val) {
     if (isSingleton()) {
         char buf[5];
         pushSingleton(buf, cp2utf8(buf, val));
     } else {
-        *this = *this + val;
+        char buf[5];
+        pushShared(buf, cp2utf8(buf, val));
     }
 }
-void string::operator+=(bool val) {
+template<typename Traits>
+void basic_string<Traits>::operator+=(bool val) {
+    const char* str = val ? "true" : "false";
+    size_type len = val ? 4 : 5;
     if (isSingleton()) {
-        if (val) {
-            pushSingleton("true", 4);
-        } else {
-            pushSingleton("false", 5);
-        }
+        pushSingleton(str, len);
     } else {
-        *this = *this + val;
+        pushShared(str, len);
     }
 }
 
-string operator+(int8_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(uint8_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(int16_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(uint16_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(int32_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(uint32_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(int64_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(uint64_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(float a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(double a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(char a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(char32_t a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
-string operator+(bool a, const string& b) {
-    string s = "";
-    s += a;
-    s += b;
-    return s;
-}
\ No newline at end of file
+INSTANTIATE_STRINGS
@@ -0,0 +1,68 @@
+#include "string.hpp"
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint64_t u64;
+typedef string_base::Replacer Replacer;
+typedef string_base::MultiFinder::Match Match;
+
+std::vector<string> Replacer::firsts(const std::vector<std::pair<string, string>>& pairs) {
+    std::vector<string> res;
+    res.reserve(pairs.size());
+    for (const auto& p : pairs) {
+        res.push_back(p.first);
+    }
+    return res;
+}
+std::vector<string> Replacer::seconds(const std::vector<std::pair<string, string>>& pairs) {
+    std::vector<string> res;
+    res.reserve(pairs.size());
+    for (const auto& p : pairs) {
+        res.push_back(p.second);
+    }
+    return res;
+}
+
+/* The first pass finds the matches and the result's length, the
+ * second copies into a result allocated once at that length. */
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::replaceMany(const Replacer& r) const {
+    const char* str = data();
+    u64 len = length();
+    std::vector<Match> matches;
+    r.froms.findSuccessive(str, len, matches);
+    if (matches.empty()) {
+        return *this;
+    }
+    u64 removed = 0, added = 0;
+    for (const Match& m : matches) {
+        removed += r.froms.needle(m.needle).length();
+        added += r.tos[m.needle].length();
+    }
+    const u64 max_len = (u64)std::numeric_limits<ssize_type>::max();
+    if (added > max_len - (len - removed)) {
+        fprintf(stderr, "err: PyExc_OverflowError; msg: replace bytes is too long\n");
+        exit(1);
+    }
+    basic_string result((ssize_type)(len - removed + added));
+    char* out = result.data();
+    u64 pos = 0;
+    for (const Match& m : matches) {
+        const string& to = r.tos[m.needle];
+        memcpy(out, str + pos, m.start - pos);
+        out += m.start - pos;
+        memcpy(out, to.data(), to.length());
+        out += to.length();
+        pos = m.start + r.froms.needle(m.needle).length();
+    }
+    memcpy(out, str + pos, len - pos);
+    return result;
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::replaceMany(
+    const std::vector<std::pair<basic_string, basic_string>>& pairs) const {
+    return replaceMany(Replacer(pairs));
+}
+
+INSTANTIATE_STRINGS
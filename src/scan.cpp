@@ -0,0 +1,644 @@
+#include "string.hpp"
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint8_t u8;
+typedef string_base::ScanLevel ScanLevel;
+
+/* On x86-64 every scan has an SSE2, an AVX2 and an AVX-512 kernel,
+ * compiled with target attributes so that the library itself needs
+ * no -m flags; the first scan asks cpuid (and the OS, through xgetbv)
+ * which ones will run. Elsewhere the portable kernels work a word at
+ * a time. No kernel reads outside the bytes it is given, so scanning
+ * up to the end of a mapped file is safe: tails are done with a
+ * narrower kernel, a masked load, or one last block that overlaps
+ * bytes already scanned. */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define LOWS 0x7f7f7f7f7f7f7f7fULL
+
+static u64 load8(const char* p) {
+    u64 v;
+    memcpy(&v, p, 8);
+    return v;
+}
+// 0x80 in each byte of x that is zero, and 0 in the others.
+static u64 zeroBytes(u64 x) {
+    return ~(((x & LOWS) + LOWS) | x) & HIGHS;
+}
+
+// libc's memchr() is already vectorized wherever it matters.
+static const char* findPortable(const char* s, char ch, u64 n) {
+    return (const char*)memchr(s, ch, n);
+}
+static const char* rfindPortable(const char* s, char ch, u64 n) {
+    u64 pattern = (u8)ch * ONES;
+    while (n >= 8 && !zeroBytes(load8(s + n - 8) ^ pattern)) {
+        n -= 8;
+    }
+    while (n > 0) {
+        n--;
+        if (s[n] == ch) {
+            return s + n;
+        }
+    }
+    return nullptr;
+}
+static u64 countPortable(const char* s, char ch, u64 n) {
+    u64 pattern = (u8)ch * ONES;
+    u64 count = 0;
+    u64 i = 0;
+    while (n - i >= 8) {
+        // a byte of acc counts at most 255 matches before it is folded
+        u64 words = (n - i) / 8;
+        if (words > 255) {
+            words = 255;
+        }
+        u64 acc = 0;
+        for (; words; words--, i += 8) {
+            acc += zeroBytes(load8(s + i) ^ pattern) >> 7;
+        }
+        acc = (acc & 0x00ff00ff00ff00ffULL) + ((acc >> 8) & 0x00ff00ff00ff00ffULL);
+        count += (acc * 0x0001000100010001ULL) >> 48;
+    }
+    for (; i < n; i++) {
+        count += s[i] == ch;
+    }
+    return count;
+}
+
+// Short-needle searches: n is the haystack's length, m the needle's.
+static bool matchesAt(const char* p, const char* needle, u64 m) {
+    return p[0] == needle[0] && p[m - 1] == needle[m - 1]
+        && memcmp(p + 1, needle + 1, m - 2) == 0;
+}
+static const char* findShortPortable(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    u64 first = (u8)needle[0] * ONES;
+    u64 last = (u8)needle[m - 1] * ONES;
+    u64 positions = n - m + 1;
+    u64 i = 0;
+    for (; i + 8 <= positions; i += 8) {
+        if (zeroBytes((load8(s + i) ^ first) | (load8(s + i + m - 1) ^ last))) {
+            for (u64 k = i; k < i + 8; k++) {
+                if (matchesAt(s + k, needle, m)) {
+                    return s + k;
+                }
+            }
+        }
+    }
+    for (; i < positions; i++) {
+        if (matchesAt(s + i, needle, m)) {
+            return s + i;
+        }
+    }
+    return nullptr;
+}
+static const char* rfindShortPortable(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    u64 first = (u8)needle[0] * ONES;
+    u64 last = (u8)needle[m - 1] * ONES;
+    // positions below e are left
+    u64 e = n - m + 1;
+    for (; e >= 8; e -= 8) {
+        if (zeroBytes((load8(s + e - 8) ^ first) | (load8(s + e - 8 + m - 1) ^ last))) {
+            for (u64 k = e; k > e - 8; k--) {
+                if (matchesAt(s + k - 1, needle, m)) {
+                    return s + k - 1;
+                }
+            }
+        }
+    }
+    while (e > 0) {
+        e--;
+        if (matchesAt(s + e, needle, m)) {
+            return s + e;
+        }
+    }
+    return nullptr;
+}
+
+#ifdef SCAN_X86
+static int lowestBit(u64 m) {
+    return __builtin_ctzll(m);
+}
+static int highestBit(u64 m) {
+    return 63 - __builtin_clzll(m);
+}
+// Bit k of mask is set when the needle's ends match at p + k.
+static const char* firstMatch(const char* p, u64 mask, const char* needle, u64 m) {
+    for (; mask; mask &= mask - 1) {
+        const char* q = p + lowestBit(mask);
+        if (memcmp(q + 1, needle + 1, m - 2) == 0) {
+            return q;
+        }
+    }
+    return nullptr;
+}
+static const char* lastMatch(const char* p, u64 mask, const char* needle, u64 m) {
+    for (; mask; mask &= ~(1ULL << highestBit(mask))) {
+        const char* q = p + highestBit(mask);
+        if (memcmp(q + 1, needle + 1, m - 2) == 0) {
+            return q;
+        }
+    }
+    return nullptr;
+}
+
+/* The wide loops only look for a block with a match in it, OR-ing
+ * the compares so that there is one test per block; the narrower
+ * loop after them then finds where it is. */
+static __m128i sse2Equal(const char* p, __m128i c) {
+    return _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), c);
+}
+static bool sse2Any(const char* p, __m128i c) {
+    __m128i a = _mm_or_si128(sse2Equal(p, c), sse2Equal(p + 16, c));
+    __m128i b = _mm_or_si128(sse2Equal(p + 32, c), sse2Equal(p + 48, c));
+    return _mm_movemask_epi8(_mm_or_si128(a, b)) != 0;
+}
+static u32 sse2Matches(const char* p, __m128i c) {
+    return _mm_movemask_epi8(sse2Equal(p, c));
+}
+static const char* findSse2(const char* s, char ch, u64 n) {
+    if (n < 16) {
+        return findPortable(s, ch, n);
+    }
+    const __m128i c = _mm_set1_epi8(ch);
+    u64 i = 0;
+    for (; i + 64 <= n; i += 64) {
+        if (sse2Any(s + i, c)) {
+            break;
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        u32 m = sse2Matches(s + i, c);
+        if (m) {
+            return s + i + lowestBit(m);
+        }
+    }
+    u32 m = i < n ? sse2Matches(s + n - 16, c) : 0;
+    return m ? s + n - 16 + lowestBit(m) : nullptr;
+}
+static const char* rfindSse2(const char* s, char ch, u64 n) {
+    if (n < 16) {
+        return rfindPortable(s, ch, n);
+    }
+    const __m128i c = _mm_set1_epi8(ch);
+    u64 e = n;
+    for (; e >= 64; e -= 64) {
+        if (sse2Any(s + e - 64, c)) {
+            break;
+        }
+    }
+    for (; e >= 16; e -= 16) {
+        u32 m = sse2Matches(s + e - 16, c);
+        if (m) {
+            return s + e - 16 + highestBit(m);
+        }
+    }
+    u32 m = e > 0 ? sse2Matches(s, c) : 0;
+    return m ? s + highestBit(m) : nullptr;
+}
+static u64 countSse2(const char* s, char ch, u64 n) {
+    const __m128i c = _mm_set1_epi8(ch);
+    const __m128i zero = _mm_setzero_si128();
+    u64 count = 0;
+    u64 i = 0;
+    while (n - i >= 64) {
+        // a byte of acc gains at most 4 per round, so 63 rounds fit
+        u64 rounds = (n - i) / 64;
+        if (rounds > 63) {
+            rounds = 63;
+        }
+        __m128i acc = zero;
+        for (; rounds; rounds--, i += 64) {
+            __m128i a = _mm_add_epi8(sse2Equal(s + i, c), sse2Equal(s + i + 16, c));
+            __m128i b = _mm_add_epi8(sse2Equal(s + i + 32, c), sse2Equal(s + i + 48, c));
+            acc = _mm_sub_epi8(acc, _mm_add_epi8(a, b));
+        }
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (u64)_mm_cvtsi128_si64(sums) + (u64)_mm_extract_epi16(sums, 4);
+    }
+    return count + countPortable(s + i, ch, n - i);
+}
+static u32 sse2Ends(const char* p, u64 m, __m128i first, __m128i last) {
+    return _mm_movemask_epi8(_mm_and_si128(sse2Equal(p, first), sse2Equal(p + m - 1, last)));
+}
+static const char* findShortSse2(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    u64 positions = n - m + 1;
+    u64 i = 0;
+    for (; i + 16 <= positions; i += 16) {
+        const char* p = firstMatch(s + i, sse2Ends(s + i, m, first, last), needle, m);
+        if (p) {
+            return p;
+        }
+    }
+    return findShortPortable(s + i, n - i, needle, m);
+}
+static const char* rfindShortSse2(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    u64 e = n - m + 1;
+    for (; e >= 16; e -= 16) {
+        const char* p = lastMatch(s + e - 16, sse2Ends(s + e - 16, m, first, last), needle, m);
+        if (p) {
+            return p;
+        }
+    }
+    return rfindShortPortable(s, e + m - 1, needle, m);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+AVX2 static __m256i avx2Equal(const char* p, __m256i c) {
+    return _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), c);
+}
+AVX2 static bool avx2Any(const char* p, __m256i c) {
+    __m256i a = _mm256_or_si256(avx2Equal(p, c), avx2Equal(p + 32, c));
+    __m256i b = _mm256_or_si256(avx2Equal(p + 64, c), avx2Equal(p + 96, c));
+    __m256i any = _mm256_or_si256(a, b);
+    return !_mm256_testz_si256(any, any);
+}
+AVX2 static u32 avx2Matches(const char* p, __m256i c) {
+    return _mm256_movemask_epi8(avx2Equal(p, c));
+}
+// n >= 32
+AVX2 static const char* findAvx2Blocks(const char* s, char ch, u64 n) {
+    const __m256i c = _mm256_set1_epi8(ch);
+    u64 i = 0;
+    for (; i + 128 <= n; i += 128) {
+        if (avx2Any(s + i, c)) {
+            break;
+        }
+    }
+    for (; i + 32 <= n; i += 32) {
+        u32 m = avx2Matches(s + i, c);
+        if (m) {
+            return s + i + lowestBit(m);
+        }
+    }
+    u32 m = i < n ? avx2Matches(s + n - 32, c) : 0;
+    return m ? s + n - 32 + lowestBit(m) : nullptr;
+}
+AVX2 static const char* rfindAvx2Blocks(const char* s, char ch, u64 n) {
+    const __m256i c = _mm256_set1_epi8(ch);
+    u64 e = n;
+    for (; e >= 128; e -= 128) {
+        if (avx2Any(s + e - 128, c)) {
+            break;
+        }
+    }
+    for (; e >= 32; e -= 32) {
+        u32 m = avx2Matches(s + e - 32, c);
+        if (m) {
+            return s + e - 32 + highestBit(m);
+        }
+    }
+    u32 m = e > 0 ? avx2Matches(s, c) : 0;
+    return m ? s + highestBit(m) : nullptr;
+}
+AVX2 static u64 countAvx2(const char* s, char ch, u64 n) {
+    const __m256i c = _mm256_set1_epi8(ch);
+    const __m256i zero = _mm256_setzero_si256();
+    u64 count = 0;
+    u64 i = 0;
+    while (n - i >= 128) {
+        u64 rounds = (n - i) / 128;
+        if (rounds > 63) {
+            rounds = 63;
+        }
+        __m256i acc = zero;
+        for (; rounds; rounds--, i += 128) {
+            __m256i a = _mm256_add_epi8(avx2Equal(s + i, c), avx2Equal(s + i + 32, c));
+            __m256i b = _mm256_add_epi8(avx2Equal(s + i + 64, c), avx2Equal(s + i + 96, c));
+            acc = _mm256_sub_epi8(acc, _mm256_add_epi8(a, b));
+        }
+        __m256i sums = _mm256_sad_epu8(acc, zero);
+        __m128i half = _mm_add_epi64(
+            _mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1)
+        );
+        count += (u64)_mm_cvtsi128_si64(half) + (u64)_mm_extract_epi64(half, 1);
+    }
+    _mm256_zeroupper();
+    return count + countSse2(s + i, ch, n - i);
+}
+AVX2 static u32 avx2Ends(const char* p, u64 m, __m256i first, __m256i last) {
+    return _mm256_movemask_epi8(_mm256_and_si256(avx2Equal(p, first), avx2Equal(p + m - 1, last)));
+}
+// Stops short of the last 32 positions.
+AVX2 static const char* findShortAvx2Blocks(const char* s, u64 n, const char* needle, u64 m, u64* done) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    u64 positions = n - m + 1;
+    u64 i = 0;
+    for (; i + 32 <= positions; i += 32) {
+        const char* p = firstMatch(s + i, avx2Ends(s + i, m, first, last), needle, m);
+        if (p) {
+            return p;
+        }
+    }
+    *done = i;
+    return nullptr;
+}
+AVX2 static const char* rfindShortAvx2Blocks(const char* s, u64 n, const char* needle, u64 m, u64* left) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    u64 e = n - m + 1;
+    for (; e >= 32; e -= 32) {
+        const char* p = lastMatch(s + e - 32, avx2Ends(s + e - 32, m, first, last), needle, m);
+        if (p) {
+            return p;
+        }
+    }
+    *left = e;
+    return nullptr;
+}
+/* GCC leaves out vzeroupper in target("avx2") functions, and SSE code
+ * run with the upper halves dirty stalls or picks up false
+ * dependencies, so the kernels clear them on the way out. */
+AVX2 static const char* findAvx2(const char* s, char ch, u64 n) {
+    if (n < 32) {
+        return findSse2(s, ch, n);
+    }
+    const char* p = findAvx2Blocks(s, ch, n);
+    _mm256_zeroupper();
+    return p;
+}
+AVX2 static const char* rfindAvx2(const char* s, char ch, u64 n) {
+    if (n < 32) {
+        return rfindSse2(s, ch, n);
+    }
+    const char* p = rfindAvx2Blocks(s, ch, n);
+    _mm256_zeroupper();
+    return p;
+}
+AVX2 static const char* findShortAvx2(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    u64 done;
+    const char* p = findShortAvx2Blocks(s, n, needle, m, &done);
+    _mm256_zeroupper();
+    return p ? p : findShortSse2(s + done, n - done, needle, m);
+}
+AVX2 static const char* rfindShortAvx2(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    u64 left;
+    const char* p = rfindShortAvx2Blocks(s, n, needle, m, &left);
+    _mm256_zeroupper();
+    return p ? p : rfindShortSse2(s, left + m - 1, needle, m);
+}
+#undef AVX2
+
+/* Compares go straight to mask registers, and the bytes past the end
+ * are masked off the load, so AVX-512 needs no narrower fallback. */
+#define AVX512 __attribute__((target("avx512f,avx512bw,popcnt")))
+AVX512 static u64 avx512Matches(const char* p, __m512i c) {
+    return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p), c);
+}
+/* Whether any of the 256 bytes at p is c. Compares into mask
+ * registers all go to one port, so the block is XOR-ed with c and
+ * reduced with byte minimums instead, for one compare per block. */
+AVX512 static bool avx512Any(const char* p, __m512i c) {
+    __m512i a = _mm512_min_epu8(
+        _mm512_xor_si512(_mm512_loadu_si512(p), c),
+        _mm512_xor_si512(_mm512_loadu_si512(p + 64), c)
+    );
+    __m512i b = _mm512_min_epu8(
+        _mm512_xor_si512(_mm512_loadu_si512(p + 128), c),
+        _mm512_xor_si512(_mm512_loadu_si512(p + 192), c)
+    );
+    __m512i least = _mm512_min_epu8(a, b);
+    return _mm512_testn_epi8_mask(least, least) != 0;
+}
+// Only the first n < 64 bytes at p.
+AVX512 static u64 avx512MatchesIn(const char* p, u64 n, __m512i c) {
+    __mmask64 k = ~0ULL >> (64 - n);
+    return _mm512_mask_cmpeq_epi8_mask(k, _mm512_maskz_loadu_epi8(k, p), c);
+}
+AVX512 static const char* findAvx512Blocks(const char* s, char ch, u64 n) {
+    const __m512i c = _mm512_set1_epi8(ch);
+    u64 i = 0;
+    for (; i + 256 <= n; i += 256) {
+        if (avx512Any(s + i, c)) {
+            break;
+        }
+    }
+    for (; i + 64 <= n; i += 64) {
+        u64 m = avx512Matches(s + i, c);
+        if (m) {
+            return s + i + lowestBit(m);
+        }
+    }
+    u64 m = i < n ? avx512MatchesIn(s + i, n - i, c) : 0;
+    return m ? s + i + lowestBit(m) : nullptr;
+}
+AVX512 static const char* rfindAvx512Blocks(const char* s, char ch, u64 n) {
+    const __m512i c = _mm512_set1_epi8(ch);
+    u64 e = n;
+    for (; e >= 256; e -= 256) {
+        if (avx512Any(s + e - 256, c)) {
+            break;
+        }
+    }
+    for (; e >= 64; e -= 64) {
+        u64 m = avx512Matches(s + e - 64, c);
+        if (m) {
+            return s + e - 64 + highestBit(m);
+        }
+    }
+    u64 m = e > 0 ? avx512MatchesIn(s, e, c) : 0;
+    return m ? s + highestBit(m) : nullptr;
+}
+AVX512 static u64 countAvx512Blocks(const char* s, char ch, u64 n) {
+    const __m512i c = _mm512_set1_epi8(ch);
+    u64 count = 0;
+    u64 i = 0;
+    for (; i + 256 <= n; i += 256) {
+        count += _mm_popcnt_u64(avx512Matches(s + i, c))
+            + _mm_popcnt_u64(avx512Matches(s + i + 64, c))
+            + _mm_popcnt_u64(avx512Matches(s + i + 128, c))
+            + _mm_popcnt_u64(avx512Matches(s + i + 192, c));
+    }
+    for (; i + 64 <= n; i += 64) {
+        count += _mm_popcnt_u64(avx512Matches(s + i, c));
+    }
+    if (i < n) {
+        count += _mm_popcnt_u64(avx512MatchesIn(s + i, n - i, c));
+    }
+    return count;
+}
+AVX512 static u64 avx512Ends(const char* p, u64 m, __m512i first, __m512i last) {
+    return avx512Matches(p, first) & avx512Matches(p + m - 1, last);
+}
+// Only the first k < 64 positions at p.
+AVX512 static u64 avx512EndsIn(const char* p, u64 k, u64 m, __m512i first, __m512i last) {
+    return avx512MatchesIn(p, k, first) & avx512MatchesIn(p + m - 1, k, last);
+}
+AVX512 static const char* findShortAvx512Blocks(const char* s, u64 n, const char* needle, u64 m) {
+    const __m512i first = _mm512_set1_epi8(needle[0]);
+    const __m512i last = _mm512_set1_epi8(needle[m - 1]);
+    u64 positions = n - m + 1;
+    u64 i = 0;
+    for (; i + 64 <= positions; i += 64) {
+        const char* p = firstMatch(s + i, avx512Ends(s + i, m, first, last), needle, m);
+        if (p) {
+            return p;
+        }
+    }
+    if (i < positions) {
+        return firstMatch(s + i, avx512EndsIn(s + i, positions - i, m, first, last), needle, m);
+    }
+    return nullptr;
+}
+AVX512 static const char* rfindShortAvx512Blocks(const char* s, u64 n, const char* needle, u64 m) {
+    const __m512i first = _mm512_set1_epi8(needle[0]);
+    const __m512i last = _mm512_set1_epi8(needle[m - 1]);
+    u64 e = n - m + 1;
+    for (; e >= 64; e -= 64) {
+        const char* p = lastMatch(s + e - 64, avx512Ends(s + e - 64, m, first, last), needle, m);
+        if (p) {
+            return p;
+        }
+    }
+    if (e > 0) {
+        return lastMatch(s, avx512EndsIn(s, e, m, first, last), needle, m);
+    }
+    return nullptr;
+}
+AVX512 static const char* findAvx512(const char* s, char ch, u64 n) {
+    const char* p = findAvx512Blocks(s, ch, n);
+    _mm256_zeroupper();
+    return p;
+}
+AVX512 static const char* rfindAvx512(const char* s, char ch, u64 n) {
+    const char* p = rfindAvx512Blocks(s, ch, n);
+    _mm256_zeroupper();
+    return p;
+}
+AVX512 static u64 countAvx512(const char* s, char ch, u64 n) {
+    u64 count = countAvx512Blocks(s, ch, n);
+    _mm256_zeroupper();
+    return count;
+}
+AVX512 static const char* findShortAvx512(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    const char* p = findShortAvx512Blocks(s, n, needle, m);
+    _mm256_zeroupper();
+    return p;
+}
+AVX512 static const char* rfindShortAvx512(const char* s, u64 n, const char* needle, u64 m) {
+    if (n < m) {
+        return nullptr;
+    }
+    const char* p = rfindShortAvx512Blocks(s, n, needle, m);
+    _mm256_zeroupper();
+    return p;
+}
+#undef AVX512
+
+static u64 enabledStates() {
+    u32 lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (u64)hi << 32 | lo;
+}
+#endif // SCAN_X86
+
+static ScanLevel supportedLevel() {
+#ifdef SCAN_X86
+    u32 a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+        return string_base::SCAN_SSE2;
+    }
+    bool popcnt = c & bit_POPCNT;
+    // the OS must save the YMM registers, and for AVX-512 the ZMM and mask ones
+    u64 states = enabledStates();
+    if ((states & 0x6) != 0x6 || !__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_AVX2)) {
+        return string_base::SCAN_SSE2;
+    }
+    if ((states & 0xe6) != 0xe6 || !(b & bit_AVX512F) || !(b & bit_AVX512BW) || !popcnt) {
+        return string_base::SCAN_AVX2;
+    }
+    return string_base::SCAN_AVX512;
+#else
+    return string_base::SCAN_PORTABLE;
+#endif
+}
+
+struct ScanKernels {
+    const char* (*find)(const char*, char, u64);
+    const char* (*rfind)(const char*, char, u64);
+    u64 (*count)(const char*, char, u64);
+    const char* (*findShort)(const char*, u64, const char*, u64);
+    const char* (*rfindShort)(const char*, u64, const char*, u64);
+};
+static const ScanKernels kernels[] = {
+    {findPortable, rfindPortable, countPortable, findShortPortable, rfindShortPortable},
+#ifdef SCAN_X86
+    {findSse2, rfindSse2, countSse2, findShortSse2, rfindShortSse2},
+    {findAvx2, rfindAvx2, countAvx2, findShortAvx2, rfindShortAvx2},
+    {findAvx512, rfindAvx512, countAvx512, findShortAvx512, rfindShortAvx512},
+#endif
+};
+/* -1 until the first scan. Constant-initialized, so scans from static
+ * constructors in other files see it too. */
+static std::atomic<int> level(-1);
+
+static const ScanKernels& activeKernels() {
+    int l = level.load(std::memory_order_relaxed);
+    if (l < 0) {
+        l = supportedLevel();
+        level.store(l, std::memory_order_relaxed);
+    }
+    return kernels[l];
+}
+
+const char* string_base::findByte(const char* s, char ch, u64 n) {
+    return activeKernels().find(s, ch, n);
+}
+const char* string_base::rfindByte(const char* s, char ch, u64 n) {
+    return activeKernels().rfind(s, ch, n);
+}
+u64 string_base::countByte(const char* s, char ch, u64 n) {
+    return activeKernels().count(s, ch, n);
+}
+const char* string_base::findShort(const char* s, u64 n, const char* needle, u64 m) {
+    return activeKernels().findShort(s, n, needle, m);
+}
+const char* string_base::rfindShort(const char* s, u64 n, const char* needle, u64 m) {
+    return activeKernels().rfindShort(s, n, needle, m);
+}
+
+ScanLevel string_base::scanLevel() {
+    activeKernels();
+    return (ScanLevel)level.load(std::memory_order_relaxed);
+}
+ScanLevel string_base::setScanLevel(ScanLevel l) {
+    ScanLevel supported = supportedLevel();
+    if (l > supported) {
+        l = supported;
+    }
+    level.store(l, std::memory_order_relaxed);
+    return l;
+}
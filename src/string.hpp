@@ -2,21 +2,499 @@
 #define STRING_ETPQWR
 
 #include <stdint.h> // for uint32_t and int32_t
+#include <atomic> // for the cached hash
+#include <stddef.h> // for size_t
 #include <type_traits> // for std::is_*
 #include <string.h> // for strlen
 #include <ostream> // for std::ostream
 #include <string>
 #include <vector>
+#include <utility> // for std::pair
+#include <memory> // for MultiFinder's shared tables
 
-class string {
+/* Heap strings use biased reference counting: the thread that
+ * allocated a buffer counts its own copies without atomics, and
+ * only other threads pay for atomic operations. That leaves
+ * nothing for a separate thread-local flavor to save: local_string
+ * is another name for string, and share() on it is a plain copy. */
+struct string_traits {
+    typedef uint32_t size_type;
+    typedef string_traits shared_traits;
+    static const size_t min_inline = 0; // SSO is whatever the object holds
+};
+/* string64 holds lengths past 4 GB (whole mmapped files, say). It
+ * is counted like string, but its object is 24 bytes instead of 16,
+ * which also gives it 23 bytes of SSO. */
+struct string64_traits {
+    typedef uint64_t size_type;
+    typedef string64_traits shared_traits;
+    static const size_t min_inline = 0;
+};
+/* sso24_string and sso32_string keep at least 24 and 32 bytes
+ * inline (31 and 39 on 64-bit systems, in 32- and 40-byte objects),
+ * for keys such as timestamps, UUIDs and IPv6 addresses that just
+ * miss string's 15. Their heap buffers are laid out like string's,
+ * so converting a heap string between them and string shares it. */
+template<size_t N> struct sso_string_traits {
+    typedef uint32_t size_type;
+    typedef sso_string_traits shared_traits;
+    static const size_t min_inline = N;
+};
+
+/* The object is a pointer and two sizes, padded in the middle when
+ * Traits asks for more inline room than that. The last byte of
+ * cap_info must stay the last byte of the object: it holds the SSO
+ * tag. */
+template<typename Traits> struct basic_string_layout {
+    typedef typename Traits::size_type size_type;
+    static const size_t natural = sizeof(char*) + 2 * sizeof(size_type);
+    static const size_t wanted = (Traits::min_inline + sizeof(char*))
+        / sizeof(char*) * sizeof(char*);
+    static const size_t pad = wanted > natural ? wanted - natural : 0;
+};
+template<typename S, size_t PAD> struct basic_string_alloc {
+    char* data;
+    char pad[PAD];
+    S len, cap_info;
+};
+template<typename S> struct basic_string_alloc<S, 0> {
+    char* data;
+    S len, cap_info;
+};
+
+// Parts of the string implementation that do not depend on the flavor.
+class string_base {
+public:
+    // stolen from tiny_utf8
+    template<typename T, typename CharType, typename DataType = bool>
+        using enable_if_ptr = typename std::enable_if<
+            std::is_pointer<typename std::remove_reference<T>::type>::value
+            &&
+            std::is_same<
+                CharType
+                , typename std::remove_cv<
+                    typename std::remove_pointer<
+                        typename std::remove_reference<T>::type
+                    >::type
+                >::type
+            >::value
+            , DataType
+        >::type;
+/* alloc.cpp */
+    struct Allocator {
+        void* (*allocate)(size_t size);
+        void* (*reallocate)(void* ptr, size_t old_size, size_t new_size);
+        void (*deallocate)(void* ptr, size_t size);
+    };
+    static Allocator mallocAllocator();
+    static Allocator poolAllocator();
+    // Must be called before any heap-backed string exists.
+    static void setAllocator(const Allocator&);
+    static const Allocator& getAllocator() {
+        return allocator;
+    }
+/* core.cpp */
+    // One memoized hash64(), kept in the allocation header.
+    struct HashCache {
+        std::atomic<uint32_t>* len;
+        std::atomic<uint64_t>* hash;
+    };
+    /* Substrings share their parent's buffer, which stays allocated
+     * as long as any of them does. substring() copies instead when the
+     * result is at most max_copy bytes and either the buffer is at
+     * least min_parent bytes and the result uses less than min_fraction
+     * of it, or the buffer is over max_parent bytes. Not synchronized:
+     * set it before other threads take substrings. */
+    struct CompactionPolicy {
+        uint64_t min_parent;
+        double min_fraction;
+        uint64_t max_parent;
+        uint64_t max_copy;
+    };
+    static void setCompactionPolicy(const CompactionPolicy&);
+    static const CompactionPolicy& getCompactionPolicy() {
+        return compaction;
+    }
+    /* Appends that outgrow a buffer move to one of the next power of
+     * two size until it reaches min_large bytes, and from there to
+     * factor times the old capacity. A large buffer that the string
+     * owns alone, starts and at least half fills is grown with the
+     * allocator's reallocate(), which can extend it where it is (or
+     * remap its pages); anything else is copied to a fresh buffer.
+     * Not synchronized: set it before other threads append. */
+    struct GrowthPolicy {
+        double factor;
+        uint64_t min_large;
+    };
+    static void setGrowthPolicy(const GrowthPolicy&);
+    static const GrowthPolicy& getGrowthPolicy() {
+        return growth;
+    }
+    // Live references using less than 1/16 of a buffer of 64 KB or more.
+    struct PinStats {
+        uint64_t refs;
+        // buffer bytes beyond each reference's own; shared buffers count once per reference
+        uint64_t bytes;
+    };
+    static PinStats pinStats();
+    // Spare capacity that basic_string::adopt() may need past the text.
+    static const int ADOPT_SLACK = 64;
+    /* Event counts, kept per thread and summed by stats(), for
+     * finding out which paths strings take. Only counted when the
+     * library is built with STRING_STATS; otherwise the counting
+     * compiles away and stats() is all zeros. */
+    struct Stats {
+        // strings built from bytes, by where the bytes ended up
+        uint64_t sso;
+        uint64_t literal;
+        uint64_t heap;
+        uint64_t mapped;
+        uint64_t adopted;
+        uint64_t substrings;
+        uint64_t substrings_copied; // by the compaction policy
+        uint64_t increfs;
+        uint64_t decrefs;
+        uint64_t appends_in_place; // += on an unshared string
+        uint64_t appends_copied; // += that had to copy a shared one
+        uint64_t regrowths; // appends that moved to a bigger buffer
+        uint64_t str_copies; // str() calls that copied to add a NUL
+        uint64_t allocations;
+        uint64_t bytes_allocated;
+        uint64_t frees;
+        uint64_t bytes_freed;
+    };
+    static Stats stats();
+    // stats() then counts from here.
+    static void resetStats();
+/* indexOf.cpp */
+    // Searchers prepared once for one needle; defined after basic_string.
+    class Finder;
+    class RFinder;
+/* indexOfAny.cpp */
+    class MultiFinder;
+/* replaceMany.cpp */
+    class Replacer;
+/* intern.cpp */
+    struct InternStats {
+        uint64_t entries;
+        uint64_t bytes; // held by the table's own copies
+        uint64_t lookups;
+        uint64_t hits;
+        // bytes that separate copies would have taken for every hit
+        uint64_t bytes_saved;
+    };
+/* plus.cpp */
+    // Leaves of a basic_string_concat: borrowed bytes...
+    struct ConcatView {
+        const char* data;
+        uint64_t len;
+        uint64_t size() const {
+            return len;
+        }
+        char* write(char* dst) const {
+            memcpy(dst, data, len);
+            return dst + len;
+        }
+    };
+    // ...or a number formatted into the expression itself.
+    template<int N> struct ConcatBuffer {
+        char data[N];
+        uint32_t len;
+        uint64_t size() const {
+            return len;
+        }
+        char* write(char* dst) const {
+            memcpy(dst, data, len);
+            return dst + len;
+        }
+    };
+    static ConcatBuffer<32> concatPart(int64_t);
+    static ConcatBuffer<32> concatPart(uint64_t);
+    static ConcatBuffer<128> concatPart(double);
+    static ConcatBuffer<1> concatPart(char);
+    static ConcatBuffer<4> concatPart(char32_t);
+    static ConcatView concatPart(bool);
+/* scan.cpp */
+    /* The byte scans behind indexOf(char), lastIndexOf(char),
+     * countOf(char) and one-byte searches and replaces. The first two
+     * work like memchr() and memrchr(): a pointer to the match, or
+     * null. */
+    static const char* findByte(const char*, char, uint64_t);
+    static const char* rfindByte(const char*, char, uint64_t);
+    static uint64_t countByte(const char*, char, uint64_t);
+    /* Like memmem(), for needles of 2 to SHORT_NEEDLE bytes: positions
+     * where the needle's first and last bytes both match are found a
+     * vector at a time, and only those are compared in full. */
+    static const int SHORT_NEEDLE = 16;
+    static const char* findShort(const char* hay, uint64_t hay_len, const char* needle, uint64_t needle_len);
+    static const char* rfindShort(const char* hay, uint64_t hay_len, const char* needle, uint64_t needle_len);
+    /* Which kernels the scans use. The first scan picks the widest the
+     * CPU and OS support. setScanLevel() picks another (to compare
+     * them, say), capped at that, and returns the level it settled on. */
+    enum ScanLevel { SCAN_PORTABLE, SCAN_SSE2, SCAN_AVX2, SCAN_AVX512 };
+    static ScanLevel scanLevel();
+    static ScanLevel setScanLevel(ScanLevel);
 private:
-    struct {
-        char* data;
-        uint32_t len, cap_info;
-    } alloc;
+    static Allocator allocator;
+    static CompactionPolicy compaction;
+    static GrowthPolicy growth;
+    template<char...> friend struct string_literal;
+    static constexpr void hashMum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+        __uint128_t r = *a;
+        r *= *b;
+        *a = (uint64_t)r;
+        *b = (uint64_t)(r >> 64);
+#else
+        uint64_t ha = *a >> 32, hb = *b >> 32;
+        uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32);
+        uint64_t c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+        *a = lo;
+        *b = hi;
+#endif
+    }
+    static constexpr uint64_t hashMix(uint64_t a, uint64_t b) {
+        hashMum(&a, &b);
+        return a ^ b;
+    }
+    // native byte order, so hashes differ between endiannesses
+    static constexpr uint64_t hashByte(const char* p, int i, int n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return (uint64_t)(uint8_t)p[i] << (8 * (n - 1 - i));
+#else
+        (void)n;
+        return (uint64_t)(uint8_t)p[i] << (8 * i);
+#endif
+    }
+    static constexpr uint64_t hashRead4(const char* p) {
+        return hashByte(p, 0, 4) | hashByte(p, 1, 4)
+            | hashByte(p, 2, 4) | hashByte(p, 3, 4);
+    }
+    static constexpr uint64_t hashRead8(const char* p) {
+        return hashByte(p, 0, 8) | hashByte(p, 1, 8)
+            | hashByte(p, 2, 8) | hashByte(p, 3, 8)
+            | hashByte(p, 4, 8) | hashByte(p, 5, 8)
+            | hashByte(p, 6, 8) | hashByte(p, 7, 8);
+    }
+protected:
+/* util.cpp */
+    static int cp2utf8(char*, char32_t);
+/* plus.cpp */
+    // Each writes a NUL-terminated number and returns its length.
+    static const int I2S_BUFLEN = 32;
+    static const int U2S_BUFLEN = I2S_BUFLEN;
+    static const int D2S_BUFLEN = 128;
+    static int i2s(char*, int64_t);
+    static int u2s(char*, uint64_t);
+    static int d2s(char*, double);
+/* hash.cpp */
+    /* hash64() follows wyhash (final version 4, public domain) by
+     * Wang Yi: 48-byte blocks are mixed in three independent lanes,
+     * each a 64x64->128 bit multiply, so the bulk loop is limited by
+     * multiplier throughput rather than by a chain through every byte.
+     * It is constexpr so "..."_s can be hashed by the compiler; the
+     * byte-wise reads compile to plain loads. */
+    static constexpr uint64_t hashBytes(const char* data, uint64_t n, uint64_t seed) {
+        const uint64_t secret[4] = {
+            0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+            0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+        };
+        const char* p = data;
+        seed ^= hashMix(seed ^ secret[0], secret[1]);
+        uint64_t a = 0, b = 0;
+        if (n <= 16) {
+            if (n >= 4) {
+                uint64_t mid = (n >> 3) << 2;
+                a = (hashRead4(p) << 32) | hashRead4(p + mid);
+                b = (hashRead4(p + n - 4) << 32) | hashRead4(p + n - 4 - mid);
+            } else if (n > 0) {
+                a = ((uint64_t)(uint8_t)p[0] << 16)
+                    | ((uint64_t)(uint8_t)p[n >> 1] << 8)
+                    | (uint8_t)p[n - 1];
+            }
+        } else {
+            uint64_t i = n;
+            if (i > 48) {
+                uint64_t seed1 = seed, seed2 = seed;
+                do {
+                    seed = hashMix(hashRead8(p) ^ secret[1], hashRead8(p + 8) ^ seed);
+                    seed1 = hashMix(hashRead8(p + 16) ^ secret[2], hashRead8(p + 24) ^ seed1);
+                    seed2 = hashMix(hashRead8(p + 32) ^ secret[3], hashRead8(p + 40) ^ seed2);
+                    p += 48;
+                    i -= 48;
+                } while (i > 48);
+                seed ^= seed1 ^ seed2;
+            }
+            while (i > 16) {
+                seed = hashMix(hashRead8(p) ^ secret[1], hashRead8(p + 8) ^ seed);
+                p += 16;
+                i -= 16;
+            }
+            a = hashRead8(p + i - 16);
+            b = hashRead8(p + i - 8);
+        }
+        a ^= secret[1];
+        b ^= seed;
+        hashMum(&a, &b);
+        return hashMix(a ^ secret[0] ^ n, b ^ secret[1]);
+    }
+    static uint32_t javaHashBytes(const char*, uint64_t);
+/* indexOf.cpp */
+    static int64_t stringlib_count(
+        const char* hay, int64_t hlen, 
+        const char* needle, int64_t nlen, 
+        int64_t maxcount
+    );
+    static int64_t stringlib_find(
+        const char* hay, int64_t hlen,
+        const char* needle, int64_t nlen,
+        int64_t maxcount
+    );
+};
+
+template<typename Traits> class basic_string;
+
+/* "..."_s is a string literal whose length and hash64() the compiler
+ * works out: hash64() on it is a constant, usable as a case label,
+ * comparing a string with it is a length check and a fixed-size
+ * memcmp, and "a"_s + "b"_s is concatenated at compile time. It
+ * converts to any flavor in O(1), as a literal-mode (or SSO) string.
+ * operator""_s is the GNU string literal operator template, which
+ * GCC and Clang accept. */
+template<char... CS> struct string_literal {
+    static constexpr uint64_t LEN = sizeof...(CS);
+    static constexpr char chars[LEN + 1] = {CS..., '\0'};
+    static constexpr uint64_t hash = string_base::hashBytes(chars, LEN, 0);
+
+    static constexpr const char* data() {
+        return chars;
+    }
+    static constexpr uint64_t length() {
+        return LEN;
+    }
+    static constexpr uint64_t hash64() {
+        return hash;
+    }
+    template<char... DS> constexpr string_literal<CS..., DS...>
+    operator+(string_literal<DS...>) const {
+        return {};
+    }
+};
+template<typename C, C... CS> constexpr string_literal<CS...> operator""_s() {
+    static_assert(std::is_same<C, char>::value, "_s takes narrow literals");
+    return {};
+}
+template<typename Traits, typename L, typename R> class basic_string_concat;
+template<typename Traits> class basic_string_builder;
+class cord;
+
+/* operator+ for basic_string and for the expressions it returns.
+ * Nothing is copied until the expression is converted to a string,
+ * which happens in one allocation however long the chain is. The
+ * expression borrows its string operands, so convert it within the
+ * statement that built it:
+ *     string s = prefix + key + ":" + value;     // fine
+ *     auto e = prefix + key;                     // dangles later
+ */
+template<typename Traits, typename Self> class basic_string_plus {
+    typedef string_base::ConcatView View;
+    // Strings are borrowed as views; expressions keep their parts.
+    static View part(const basic_string<Traits>& s) {
+        return View{s.data(), s.length()};
+    }
+    template<typename L, typename R>
+    static const basic_string_concat<Traits, L, R>& part(const basic_string_concat<Traits, L, R>& e) {
+        return e;
+    }
+    typedef typename std::conditional<
+        std::is_same<Self, basic_string<Traits>>::value, View, Self
+    >::type Left;
+    template<typename R> basic_string_concat<Traits, Left, R> concat(const R& right) const {
+        return basic_string_concat<Traits, Left, R>(
+            part(*static_cast<const Self*>(this)), right
+        );
+    }
+public:
+    template<typename T, string_base::enable_if_ptr<T, char> = true>
+    basic_string_concat<Traits, Left, View> operator+(T&& str) const {
+        return concat(View{str, strlen(str)});
+    }
+    template<int32_t LITLEN>
+    basic_string_concat<Traits, Left, View> operator+(const char (&literal)[LITLEN]) const {
+        return concat(View{literal, LITLEN-1});
+    }
+    basic_string_concat<Traits, Left, View> operator+(const basic_string<Traits>& s) const {
+        return concat(part(s));
+    }
+    template<typename L, typename R>
+    basic_string_concat<Traits, Left, basic_string_concat<Traits, L, R>> operator+(const basic_string_concat<Traits, L, R>& e) const {
+        return concat(e);
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(int64_t val) const {
+        return concat(string_base::concatPart(val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(uint64_t val) const {
+        return concat(string_base::concatPart(val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(int32_t val) const {
+        return concat(string_base::concatPart((int64_t)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(uint32_t val) const {
+        return concat(string_base::concatPart((uint64_t)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(int16_t val) const {
+        return concat(string_base::concatPart((int64_t)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(uint16_t val) const {
+        return concat(string_base::concatPart((uint64_t)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(int8_t val) const {
+        return concat(string_base::concatPart((int64_t)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<32>> operator+(uint8_t val) const {
+        return concat(string_base::concatPart((uint64_t)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<128>> operator+(float val) const {
+        return concat(string_base::concatPart((double)val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<128>> operator+(double val) const {
+        return concat(string_base::concatPart(val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<1>> operator+(char val) const {
+        return concat(string_base::concatPart(val));
+    }
+    basic_string_concat<Traits, Left, string_base::ConcatBuffer<4>> operator+(char32_t cp) const {
+        return concat(string_base::concatPart(cp));
+    }
+    basic_string_concat<Traits, Left, View> operator+(bool val) const {
+        return concat(string_base::concatPart(val));
+    }
+};
+
+template<typename Traits> class basic_string
+    : public string_base, public basic_string_plus<Traits, basic_string<Traits>> {
+    template<typename> friend class basic_string;
+    template<typename, typename> friend class basic_string_plus;
+    template<typename, typename, typename> friend class basic_string_concat;
+    friend class cord;
+    friend class string_base::Finder;
+    friend class string_base::RFinder;
+    friend class string_base::MultiFinder;
+    friend class string_base::Replacer;
+    template<typename> friend class basic_string_builder;
+public:
+    typedef typename Traits::size_type size_type;
+    typedef typename std::make_signed<size_type>::type ssize_type;
+private:
+    basic_string_alloc<size_type, basic_string_layout<Traits>::pad> alloc;
 /* core.cpp */
-    void setAllocCap(uint32_t);
-    uint32_t getAllocCap() const;
+    void setAllocCap(size_type);
+    size_type getAllocCap() const;
     bool allocActive() const;
     bool ssoActive() const;
     bool litActive() const;
@@ -24,39 +502,66 @@ private:
     int getSsoLen() const;
     char* data() const;
 public:
-    uint32_t length() const;
-    string();
+    size_type length() const;
+    basic_string();
 private:
-    string(int32_t);
-    string(const char* one, const char* two, 
-        uint32_t one_len, uint32_t two_len);
+    basic_string(ssize_type);
+    basic_string(const char* one, const char* two, 
+        size_type one_len, size_type two_len);
     void incref() const;
     void decref() const;
     uint32_t refcnt() const;
+    HashCache hashCache() const;
 private:
-    string(const char*, int32_t, bool);
+    basic_string(const char*, ssize_type, bool);
 public:
-    string(const char* str, int32_t len)
-        : string(str, len, false) {}
-    template<int32_t LITLEN> string(const char (&literal)[LITLEN]) 
-        : string(literal, LITLEN-1, true) {}
-    template<typename T> string(T&& str) 
-        : string(str, strlen(str)) {}
+    basic_string(const char* str, ssize_type len)
+        : basic_string(str, len, false) {}
+    template<int32_t LITLEN> basic_string(const char (&literal)[LITLEN]) 
+        : basic_string(literal, LITLEN-1, true) {}
+    template<typename T, enable_if_ptr<T, char> = true> basic_string(T&& str) 
+        : basic_string(str, strlen(str)) {}
+    template<char... CS> basic_string(string_literal<CS...> lit)
+        : basic_string(lit.data(), lit.length(), true) {}
 private:
-    string(const string* src, 
-        uint32_t start, uint32_t end);
+    basic_string(const basic_string* src, 
+        size_type start, size_type end);
 public:
-    ~string();
+    ~basic_string();
 
-    string(const string&);
-    string& operator=(const string&);
-    string(string&&);
-    string& operator=(string&&);
+    basic_string(const basic_string&);
+    basic_string& operator=(const basic_string&);
+    basic_string(basic_string&&);
+    basic_string& operator=(basic_string&&);
+
+    /* Between flavors with the same size_type, heap and literal
+     * strings keep their buffer; only inline text is copied, as is
+     * everything going to or from string64. Each flavor interns into
+     * its own table, so an interned buffer is copied too. */
+    template<typename Other, typename = typename std::enable_if<
+        !std::is_same<Other, Traits>::value
+    >::type> explicit basic_string(const basic_string<Other>& s)
+        : basic_string() {
+        if (sizeof(typename Other::size_type) == sizeof(size_type)
+        && !s.ssoActive() && !s.isInterned()) {
+            alloc.data = s.alloc.data;
+            alloc.len = (size_type)s.alloc.len;
+            alloc.cap_info = (size_type)s.alloc.cap_info;
+            if (allocActive()) {
+                incref();
+            }
+        } else {
+            *this = basic_string(s.data(), s.length());
+        }
+    }
+
+    basic_string<typename Traits::shared_traits> share() const&;
+    basic_string<typename Traits::shared_traits> share() &&;
 #define SSO_CAP (sizeof(alloc)-1)
 #define SSO_DATA ((char*)&alloc)
 #define SSO_INFO (*(SSO_DATA + SSO_CAP))
 #define SSO_ACTIVE (!(SSO_INFO & 1))
-    char operator[](uint32_t i) const {
+    char operator[](size_type i) const {
         if (SSO_ACTIVE) {
             return SSO_DATA[i];
         } else {
@@ -68,82 +573,66 @@ public:
 #undef SSO_INFO
 #undef SSO_DATA
     const char* str();
+    /* Freezes the string for the rest of the process: its buffer is
+     * never freed and copies of it are as cheap as copies of a literal. */
+    void makeImmortal();
+    /* Maps a file read-only and returns its contents without copying
+     * them; substrings and searches work on the page cache directly
+     * and the last reference unmaps it. Returns an empty string and
+     * sets *ok to false if the file can't be opened, mapped or held
+     * by this flavor (string stops short of 2 GB; use string64). */
+    static basic_string mapFile(const char* path, bool* ok = nullptr);
+    /* Takes over a buffer instead of copying it: the text stays where
+     * it is, substrings share it, and release(context) runs on the
+     * thread that drops the last reference. The reference count lives
+     * in the capacity past len, which needs up to ADOPT_SLACK bytes; a
+     * buffer with less room, or a short string, is copied and
+     * released at once. */
+    static basic_string adopt(char* data, size_type len, size_type capacity,
+        void (*release)(void* context), void* context);
+    // Moves the container's buffer in, under the same rule.
+    static basic_string adopt(std::string&&);
+    static basic_string adopt(std::vector<char>&&);
+    // True for the canonical copies handed out by intern().
+    bool isInterned() const;
+    /* Gives a substring, or a string with spare room, a buffer of its
+     * own and exactly its size, so whatever it was cut from can be freed. */
+    void compact();
 private:
-    void ensureSpaceFor(uint32_t);
-    void pushSingleton(const char*, uint32_t);
+    void markInterned();
+    void ensureSpaceFor(size_type);
+    bool growLarge(size_type);
+    void pushSingleton(const char*, size_type);
     void pushSingletonChar(int);
+    void setLength(size_type);
+    void pushShared(const char*, size_type);
     bool isSingleton() const;
-    void shrinkNonSubstringToFitLength(uint32_t);
+    char* writableData();
+    void shrinkNonSubstringToFitLength(size_type);
 public:
-    string substring(uint32_t) const;
-    string substring(uint32_t, uint32_t) const;
+    basic_string substring(size_type) const;
+    basic_string substring(size_type, size_type) const;
 /* plus.cpp */
-    // stolen from tiny_utf8
-    template<typename T, typename CharType, typename DataType = bool>
-        using enable_if_ptr = typename std::enable_if<
-            std::is_pointer<typename std::remove_reference<T>::type>::value
-            &&
-            std::is_same<
-                CharType
-                , typename std::remove_cv<
-                    typename std::remove_pointer<
-                        typename std::remove_reference<T>::type
-                    >::type
-                >::type
-            >::value
-            , DataType
-        >::type;
-    template<typename T> enable_if_ptr<T, char, string> operator+(T&& str) const {
-        return string(
-            data(), str,
-            length(), strlen(str)
-        );
-    }
-    template<int32_t LITLEN> string operator+(const char (&literal)[LITLEN]) const {
-        return string(
-            data(), literal,
-            length(), LITLEN-1
-        );
-    }
-    string operator+(const string& s) const {
-        return string(
-            data(), s.data(), 
-            length(), s.length()
-        );
-    }
-    string operator+(int64_t) const;
-    string operator+(uint64_t) const;
-    string operator+(int32_t) const;
-    string operator+(uint32_t) const;
-    string operator+(int16_t) const;
-    string operator+(uint16_t) const;
-    string operator+(int8_t) const;
-    string operator+(uint8_t) const;
-    string operator+(float) const;
-    string operator+(double) const;
-    string operator+(char) const;
-    string operator+(char32_t) const;
-    string operator+(bool) const;
-    
+    // operator+ comes from basic_string_plus.
     template<typename T> enable_if_ptr<T, char, void> operator+=(T&& str) {
         if (isSingleton()) {
             pushSingleton(str, strlen(str));
         } else {
-            *this = *this + str;
+            pushShared(str, strlen(str));
         }
     }
     template<int32_t LITLEN> void operator+=(const char (&literal)[LITLEN]) {
         if (isSingleton()) {
             pushSingleton(literal, LITLEN-1);
         } else {
-            *this = *this + literal;
+            pushShared(literal, LITLEN-1);
         }
     }
-    void operator+=(const string& s) {
+    void operator+=(const basic_string& s) {
         if (isSingleton()) {
             pushSingleton(s.data(), s.length());
         } else {
-            *this = *this + s;
+            pushShared(s.data(), s.length());
         }
     }
     void operator+=(int64_t);
@@ -160,35 +649,63 @@ public:
     void operator+=(char32_t);
     void operator+=(bool);
 
-    template<typename T> friend enable_if_ptr<T, char, string> operator+(T&& a, const string& b) {
-        return string(
-            a, b.data(), 
-            strlen(a), b.length()
+private:
+    template<typename L> static basic_string_concat<Traits, L, ConcatView> prepend(const L& left, const basic_string& b) {
+        return basic_string_concat<Traits, L, ConcatView>(
+            left, ConcatView{b.data(), b.length()}
         );
     }
-    template<int32_t LITLEN> friend string operator+(const char (&literal)[LITLEN], const string& b) {
-        return string(
-            literal, b.data(),
-            LITLEN, b.length()
-        );
+public:
+    template<typename T> friend enable_if_ptr<T, char, basic_string_concat<Traits, ConcatView, ConcatView>> operator+(T&& a, const basic_string& b) {
+        return prepend(ConcatView{a, strlen(a)}, b);
+    }
+    template<int32_t LITLEN> friend basic_string_concat<Traits, ConcatView, ConcatView> operator+(const char (&literal)[LITLEN], const basic_string& b) {
+        return prepend(ConcatView{literal, LITLEN-1}, b);
     }
 
-    friend string operator+(int8_t a, const string& b);
-    friend string operator+(uint8_t a, const string& b);
-    friend string operator+(int16_t a, const string& b);
-    friend string operator+(uint16_t a, const string& b);
-    friend string operator+(int32_t a, const string& b);
-    friend string operator+(uint32_t a, const string& b);
-    friend string operator+(int64_t a, const string& b);
-    friend string operator+(uint64_t a, const string& b);
-    friend string operator+(float a, const string& b);
-    friend string operator+(double a, const string& b);
-    friend string operator+(char a, const string& b);
-    friend string operator+(char32_t a, const string& b);
-    friend string operator+(bool a, const string& b);
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(int8_t a, const basic_string& b) {
+        return prepend(concatPart((int64_t)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(uint8_t a, const basic_string& b) {
+        return prepend(concatPart((uint64_t)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(int16_t a, const basic_string& b) {
+        return prepend(concatPart((int64_t)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(uint16_t a, const basic_string& b) {
+        return prepend(concatPart((uint64_t)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(int32_t a, const basic_string& b) {
+        return prepend(concatPart((int64_t)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(uint32_t a, const basic_string& b) {
+        return prepend(concatPart((uint64_t)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(int64_t a, const basic_string& b) {
+        return prepend(concatPart(a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<32>, ConcatView> operator+(uint64_t a, const basic_string& b) {
+        return prepend(concatPart(a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<128>, ConcatView> operator+(float a, const basic_string& b) {
+        return prepend(concatPart((double)a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<128>, ConcatView> operator+(double a, const basic_string& b) {
+        return prepend(concatPart(a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<1>, ConcatView> operator+(char a, const basic_string& b) {
+        return prepend(concatPart(a), b);
+    }
+    friend basic_string_concat<Traits, ConcatBuffer<4>, ConcatView> operator+(char32_t a, const basic_string& b) {
+        return prepend(concatPart(a), b);
+    }
+    friend basic_string_concat<Traits, ConcatView, ConcatView> operator+(bool a, const basic_string& b) {
+        return prepend(concatPart(a), b);
+    }
 private:
 /* compare.cpp */
-    int compareInternal(const char*, uint32_t) const;
+    int compareInternal(const char*, size_type) const;
+    bool equalsInternal(const basic_string&) const;
 public:
     template<typename T> enable_if_ptr<T, char, int> compare(T&& str) const {
         return compareInternal(str, strlen(str));
@@ -196,31 +713,44 @@ public:
     template<int32_t LITLEN> int compare(const char (&literal)[LITLEN]) const {
         return compareInternal(literal, LITLEN-1);
     }
-    int compare(const string& s) const {
+    int compare(const basic_string& s) const {
         return compareInternal(s.data(), s.length());
     }
 
+    // The length is a constant, so the compiler inlines the memcmp.
     template<int32_t LITLEN> bool operator==(const char (&literal)[LITLEN]) const {
-        return length() == LITLEN
-            && compare(literal) == 0;
+        return length() == LITLEN-1
+            && memcmp(data(), literal, LITLEN-1) == 0;
+    }
+    template<char... CS> bool operator==(string_literal<CS...> lit) const {
+        return length() == lit.length()
+            && memcmp(data(), lit.data(), lit.length()) == 0;
+    }
+    template<char... CS> bool operator!=(string_literal<CS...> lit) const {
+        return !(*this == lit);
     }
     template<typename T> enable_if_ptr<T, char, bool> operator==(T&& str) const {
-        uint32_t str_len = strlen(str);
+        size_type str_len = strlen(str);
         if (length() != str_len) {
             return false;
         }
         return compareInternal(str, str_len) == 0;
     }
-    bool operator==(const string& s) const {
+    bool operator==(const basic_string& s) const {
         return length() == s.length()
-            && compare(s) == 0;
+            && equalsInternal(s);
     }
 
-    template<int32_t LITLEN> friend bool operator==(const char (&a)[LITLEN], const string& b) {
-        return b.length() == LITLEN
-            && b.compare(a) == 0;
+    template<int32_t LITLEN> friend bool operator==(const char (&a)[LITLEN], const basic_string& b) {
+        return b == a;
+    }
+    template<char... CS> friend bool operator==(string_literal<CS...> a, const basic_string& b) {
+        return b == a;
     }
-    template<typename T> friend enable_if_ptr<T, char, bool> operator==(T&& a, const string& b) {
+    template<char... CS> friend bool operator!=(string_literal<CS...> a, const basic_string& b) {
+        return !(b == a);
+    }
+    template<typename T> friend enable_if_ptr<T, char, bool> operator==(T&& a, const basic_string& b) {
         return b.compare(a) == 0;
     }
 
@@ -230,28 +760,28 @@ public:
     template<typename T> enable_if_ptr<T, char, bool> operator!=(T&& str) const {
         return !(*this == str);
     }
-    bool operator!=(const string& s) const {
+    bool operator!=(const basic_string& s) const {
         return !(*this == s);
     }
 
-    template<int32_t LITLEN> friend bool operator!=(const char (&a)[LITLEN], const string& b) {
+    template<int32_t LITLEN> friend bool operator!=(const char (&a)[LITLEN], const basic_string& b) {
         return !(b == a);
     }
-    template<typename T> friend enable_if_ptr<T, char, bool> operator!=(T&& a, const string& b) {
+    template<typename T> friend enable_if_ptr<T, char, bool> operator!=(T&& a, const basic_string& b) {
         return !(b == a);
     }
 /* haskell.cpp */
-    string drop(uint32_t) const;
+    basic_string drop(size_type) const;
     char head() const;
-    string init() const;
+    basic_string init() const;
     char last() const;
-    string tail() const;
-    string take(uint32_t) const;
+    basic_string tail() const;
+    basic_string take(size_type) const;
 /* more functionals */
-    template <typename F> string filter(F f) const {
-        string result = "";
-        uint32_t my_slen = length();
-        for (uint32_t i = 0; i < my_slen; i++) {
+    template <typename F> basic_string filter(F f) const {
+        basic_string result = "";
+        size_type my_slen = length();
+        for (size_type i = 0; i < my_slen; i++) {
             int ch = (*this)[i];
             if (f(ch)) {
                 result.pushSingletonChar(ch);
@@ -259,10 +789,10 @@ public:
         }
         return result;
     }
-    template <typename F> string filterWithIndex(F f) const {
-        string result = "";
-        uint32_t my_slen = length();
-        for (uint32_t i = 0; i < my_slen; i++) {
+    template <typename F> basic_string filterWithIndex(F f) const {
+        basic_string result = "";
+        size_type my_slen = length();
+        for (size_type i = 0; i < my_slen; i++) {
             int ch = (*this)[i];
             if (f(ch, i)) {
                 result.pushSingletonChar(ch);
@@ -271,46 +801,72 @@ public:
         return result;
     }
     template <typename F> void forEach(F f) const {
-        uint32_t my_len = length();
-        for (uint32_t i = 0; i < my_len; i++) {
+        size_type my_len = length();
+        for (size_type i = 0; i < my_len; i++) {
             f((*this)[i]);
         }
     }
     template <typename F> void forEachWithIndex(F f) const {
-        uint32_t my_len = length();
-        for (uint32_t i = 0; i < my_len; i++) {
+        size_type my_len = length();
+        for (size_type i = 0; i < my_len; i++) {
             f((*this)[i], i);
         }
     }
-    template <typename F> string map(F f) const {
-        uint32_t len = length();
-        string result((int32_t)len);
+    template <typename F> basic_string map(F f) const& {
+        size_type len = length();
+        basic_string result((ssize_type)len);
         char* res_data = result.data();
-        for (uint32_t i = 0; i < len; i++) {
+        for (size_type i = 0; i < len; i++) {
             res_data[i] = (char)f((*this)[i]);
         }
         return result;
     }
-    template <typename F> string mapWithIndex(F f) const {
-        uint32_t len = length();
-        string result((int32_t)len);
+    /* The && overloads here and in toCase.cpp, trim.cpp, misc.cpp
+     * and replace(char, char) rewrite a temporary in place when it is
+     * the only reference to a buffer it may write, so a chain such as
+     * s.trim().toLowerCase().replace('-', '_') copies once. */
+    template <typename F> basic_string map(F f) && {
+        char* str = writableData();
+        if (!str) {
+            return map(f);
+        }
+        size_type len = length();
+        for (size_type i = 0; i < len; i++) {
+            str[i] = (char)f(str[i]);
+        }
+        return std::move(*this);
+    }
+    template <typename F> basic_string mapWithIndex(F f) const& {
+        size_type len = length();
+        basic_string result((ssize_type)len);
         char* res_data = result.data();
-        for (uint32_t i = 0; i < len; i++) {
+        for (size_type i = 0; i < len; i++) {
             res_data[i] = (char)f((*this)[i], i);
         }
         return result;
     }
+    template <typename F> basic_string mapWithIndex(F f) && {
+        char* str = writableData();
+        if (!str) {
+            return mapWithIndex(f);
+        }
+        size_type len = length();
+        for (size_type i = 0; i < len; i++) {
+            str[i] = (char)f(str[i], i);
+        }
+        return std::move(*this);
+    }
     template<typename F, typename T> T reduce(T initial, F f) const {
         T result = initial;
-        uint32_t my_len = length();
-        for (uint32_t i = 0; i < my_len; i++) {
+        size_type my_len = length();
+        for (size_type i = 0; i < my_len; i++) {
             result = (T)f(result, (*this)[i]);
         }
         return result;
     }
     template<typename F, typename T> T reduceRight(T initial, F f) const {
         T result = initial;
-        for (uint32_t i = length();; i--) {
+        for (size_type i = length();; i--) {
             result = (T)f(result, (*this)[i]);
             if (i == 0) {
                 break;
@@ -320,7 +876,7 @@ public:
     }
 /* with.cpp */
 private:
-    bool startsWithInternal(const char*, uint32_t) const;
+    bool startsWithInternal(const char*, size_type) const;
 public:
     template<typename T> enable_if_ptr<T, char, bool> startsWith(T&& str) const {
         return startsWithInternal(str, strlen(str));
@@ -328,18 +884,14 @@ public:
     template<int32_t LITLEN> bool startsWith(const char (&literal)[LITLEN]) const {
         return startsWithInternal(literal, LITLEN-1);
     }
-    bool startsWith(const string& s) const {
+    bool startsWith(const basic_string& s) const {
         return startsWithInternal(s.data(), s.length());
     }
-private:
-/* util.cpp */
-    static int cp2utf8(char*, char32_t);
-public:
 /* with.cpp */
     bool startsWith(char) const;
     bool startsWith(char32_t cp) const;
 private:
-    bool endsWithInternal(const char*, uint32_t) const;
+    bool endsWithInternal(const char*, size_type) const;
 public:
     template<typename T> enable_if_ptr<T, char, bool> endsWith(T&& str) const {
         return endsWithInternal(str, strlen(str));
@@ -347,28 +899,44 @@ public:
     template<int32_t LITLEN> bool endsWith(const char (&literal)[LITLEN]) const {
         return endsWithInternal(literal, LITLEN-1);
     }
-    bool endsWith(const string& s) const {
+    bool endsWith(const basic_string& s) const {
         return endsWithInternal(s.data(), s.length());
     }
     bool endsWith(char) const;
     bool endsWith(char32_t cp) const;
 /* hash.cpp */
+    // 64-bit wyhash-style hash; values may change between versions.
+    uint64_t hash64(uint64_t seed = 0) const;
+    // hash64() folded to 32 bits.
     uint32_t hashCode() const;
+    // Java's String.hashCode(): s[0]*31^(n-1) + ... + s[n-1].
+    uint32_t javaHashCode() const;
+/* intern.cpp */
+    /* Returns the one canonical copy of this text, shared by every
+     * caller that interns the same bytes, so millions of copies of a
+     * few thousand names cost one buffer each. Two interned strings
+     * compare equal only by pointer. Short strings already live in
+     * SSO and are returned as they are. */
+    basic_string<typename Traits::shared_traits> intern() const;
+    static InternStats internStats();
+    /* Drops interned strings that nobody but the table references
+     * any more, returning how many were dropped. */
+    static uint64_t evictInterned();
 private:
 /* indexOf.cpp */
-    int32_t indexOfInternal(const char*, uint32_t) const;
+    ssize_type indexOfInternal(const char*, size_type) const;
 public:
-    template<typename T> enable_if_ptr<T, char, int32_t> indexOf(T&& str) const {
+    template<typename T> enable_if_ptr<T, char, ssize_type> indexOf(T&& str) const {
         return indexOfInternal(str, strlen(str));
     }
-    template<int32_t LITLEN> int32_t indexOf(const char (&literal)[LITLEN]) const {
+    template<int32_t LITLEN> ssize_type indexOf(const char (&literal)[LITLEN]) const {
         return indexOfInternal(literal, LITLEN-1);
     }
-    int32_t indexOf(const string& s) const {
+    ssize_type indexOf(const basic_string& s) const {
         return indexOfInternal(s.data(), s.length());
     }
-    int32_t indexOf(char) const;
-    int32_t indexOf(char32_t) const;
+    ssize_type indexOf(char) const;
+    ssize_type indexOf(char32_t) const;
 
     template<typename T> enable_if_ptr<T, char, bool> includes(T&& str) const {
         return indexOf(str) != -1;
@@ -376,7 +944,7 @@ public:
     template<int32_t LITLEN> bool includes(const char (&literal)[LITLEN]) const {
         return indexOf(literal) != -1;
     }
-    bool includes(const string& s) const {
+    bool includes(const basic_string& s) const {
         return indexOf(s) != -1;
     }
     bool includes(char ch) const {
@@ -386,102 +954,100 @@ public:
         return indexOf(cp) != -1;
     }
 private:
-    int32_t lastIndexOfInternal(const char*, uint32_t) const;
+    ssize_type lastIndexOfInternal(const char*, size_type) const;
 public:
-    template<typename T> enable_if_ptr<T, char, int32_t> lastIndexOf(T&& str) const {
+    template<typename T> enable_if_ptr<T, char, ssize_type> lastIndexOf(T&& str) const {
         return lastIndexOfInternal(str, strlen(str));
     }
-    template<int32_t LITLEN> int32_t lastIndexOf(const char (&literal)[LITLEN]) const {
+    template<int32_t LITLEN> ssize_type lastIndexOf(const char (&literal)[LITLEN]) const {
         return lastIndexOfInternal(literal, LITLEN-1);
     }
-    int32_t lastIndexOf(const string& s) const {
+    ssize_type lastIndexOf(const basic_string& s) const {
         return lastIndexOfInternal(s.data(), s.length());
     }
-    int32_t lastIndexOf(char) const;
-    int32_t lastIndexOf(char32_t) const;
+    ssize_type lastIndexOf(char) const;
+    ssize_type lastIndexOf(char32_t) const;
 private:
-    uint32_t countOfInternal(const char*, uint32_t) const;
+    size_type countOfInternal(const char*, size_type) const;
 public:
-    template<typename T> enable_if_ptr<T, char, uint32_t> countOf(T&& str) const {
+    template<typename T> enable_if_ptr<T, char, size_type> countOf(T&& str) const {
         return countOfInternal(str, strlen(str));
     }
-    template<int32_t LITLEN> uint32_t countOf(const char (&literal)[LITLEN]) const {
+    template<int32_t LITLEN> size_type countOf(const char (&literal)[LITLEN]) const {
         return countOfInternal(literal, LITLEN-1);
     }
-    uint32_t countOf(const string& s) const {
+    size_type countOf(const basic_string& s) const {
         return countOfInternal(s.data(), s.length());
     }
-    uint32_t countOf(char) const;
-    uint32_t countOf(char32_t) const;
-private:
-    static int32_t stringlib_count(
-        const char* hay, int32_t hlen, 
-        const char* needle, int32_t nlen, 
-        int32_t maxcount
-    );
-    static int32_t stringlib_find(
-        const char* hay, int32_t hlen,
-        const char* needle, int32_t nlen,
-        int32_t maxcount
-    );
+    size_type countOf(char) const;
+    size_type countOf(char32_t) const;
+/* indexOfAny.cpp */
+    // Where the first of several needles starts (see MultiFinder::find), or -1.
+    ssize_type indexOfAny(const MultiFinder&) const;
+    ssize_type indexOfAny(const std::vector<basic_string>&) const;
+    bool includesAny(const MultiFinder&) const;
+    bool includesAny(const std::vector<basic_string>&) const;
+    // countOf() for each needle, in one pass.
+    std::vector<size_type> countOfEach(const MultiFinder&) const;
+    std::vector<size_type> countOfEach(const std::vector<basic_string>&) const;
 private:
 /* transmogrify.cpp */
-    string stringlib_expandtabs_impl(int tabsize) const;
-    string pad(int32_t left, int32_t right, char fill) const;
-    string stringlib_replace_interleave(const char* to_s, int32_t to_len, int32_t maxcount) const;
-    string stringlib_replace_delete_single_character(char from_c, int32_t maxcount) const;
-    string stringlib_replace_delete_substring(const char *from_s, int32_t from_len, int32_t maxcount) const;
-    string stringlib_replace_single_character_in_place(char from_c, char to_c, int32_t maxcount) const;
-    string stringlib_replace_substring_in_place(
-        const char *from_s, int32_t from_len,
-        const char *to_s, int32_t to_len,
-        int32_t maxcount
+    basic_string stringlib_expandtabs_impl(int tabsize) const;
+    basic_string pad(int64_t left, int64_t right, char fill) const;
+    basic_string stringlib_replace_interleave(const char* to_s, int64_t to_len, int64_t maxcount) const;
+    basic_string stringlib_replace_delete_single_character(char from_c, int64_t maxcount) const;
+    basic_string stringlib_replace_delete_substring(const char *from_s, int64_t from_len, int64_t maxcount) const;
+    basic_string stringlib_replace_single_character_in_place(char from_c, char to_c, int64_t maxcount) const;
+    basic_string stringlib_replace_substring_in_place(
+        const char *from_s, int64_t from_len,
+        const char *to_s, int64_t to_len,
+        int64_t maxcount
     ) const;
-    string stringlib_replace_single_character(
+    basic_string stringlib_replace_single_character(
         char from_c, const char *to_s, 
-        int32_t to_len, int32_t maxcount
+        int64_t to_len, int64_t maxcount
     ) const;
-    string stringlib_replace_substring(
-        const char *from_s, int32_t from_len,
-        const char *to_s, int32_t to_len,
-        int32_t maxcount
+    basic_string stringlib_replace_substring(
+        const char *from_s, int64_t from_len,
+        const char *to_s, int64_t to_len,
+        int64_t maxcount
     ) const;
-    string stringlib_replace(
-        const char *from_s, int32_t from_len,
-        const char *to_s, int32_t to_len,
-        int32_t maxcount
+    basic_string stringlib_replace(
+        const char *from_s, int64_t from_len,
+        const char *to_s, int64_t to_len,
+        int64_t maxcount
     ) const;
 public:
-    // five types: T&& (const char*), const char(&)[LITLEN], const string&, char, char32_t.
-    template<typename T> enable_if_ptr<T, char, string> 
+    // five types: T&& (const char*), const char(&)[LITLEN], const basic_string&, char, char32_t.
+    template<typename T> enable_if_ptr<T, char, basic_string> 
     replace(T&& from, T&& to) const {
         return stringlib_replace(
             from, strlen(from), 
-            to, strlen(to), INT32_MAX
+            to, strlen(to), INT64_MAX
         );
     }
-    template<typename T, int32_t LITLEN> enable_if_ptr<T, char, string> 
+    template<typename T, int32_t LITLEN> enable_if_ptr<T, char, basic_string> 
     replace(T&& from, const char (&to_literal)[LITLEN]) const {
         return stringlib_replace(
             from, strlen(from),
-            to_literal, LITLEN, INT32_MAX
+            to_literal, LITLEN, INT64_MAX
         );
     }
-    template<typename T> enable_if_ptr<T, char, string> 
-    replace(T&& from, const string& to) const {
+    template<typename T> enable_if_ptr<T, char, basic_string> 
+    replace(T&& from, const basic_string& to) const {
         return stringlib_replace(
             from, strlen(from),
-            to.data(), to.length(), INT32_MAX
+            to.data(), to.length(), INT64_MAX
         );
     }
-    template<typename T> enable_if_ptr<T, char, string> 
+    template<typename T> enable_if_ptr<T, char, basic_string> 
     replace(T&& from, char to) const {
         return stringlib_replace(
             from, strlen(from),
-            &to, 1, INT32_MAX
+            &to, 1, INT64_MAX
         );
     }
-    template<typename T> enable_if_ptr<T, char, string> 
+    template<typename T> enable_if_ptr<T, char, basic_string> 
     replace(T&& from, char32_t to) const {
         char buf[5];
         return stringlib_replace(
@@ -490,182 +1056,618 @@ public:
         );
     }
     
-    template<int32_t LITLEN, typename T> enable_if_ptr<T, char, string> 
+    template<int32_t LITLEN, typename T> enable_if_ptr<T, char, basic_string> 
     replace(const char(&from_literal)[LITLEN], T&& to) const {
         return stringlib_replace(
             from_literal, LITLEN,
-            to, strlen(to), INT32_MAX
+            to, strlen(to), INT64_MAX
         );
     }
-    template<int32_t LITLEN1, int32_t LITLEN2> string
+    template<int32_t LITLEN1, int32_t LITLEN2> basic_string
     replace(const char(&from_literal)[LITLEN1], const char(&to_literal)[LITLEN2]) const {
         return stringlib_replace(
             from_literal, LITLEN1,
-            to_literal, LITLEN2, INT32_MAX
+            to_literal, LITLEN2, INT64_MAX
         );
     }
-    template<int32_t LITLEN> string
-    replace(const char(&from_literal)[LITLEN], const string& to) const {
+    template<int32_t LITLEN> basic_string
+    replace(const char(&from_literal)[LITLEN], const basic_string& to) const {
         return stringlib_replace(
             from_literal, LITLEN,
-            to.data(), to.length(), INT32_MAX
+            to.data(), to.length(), INT64_MAX
         );
     }
-    template<int32_t LITLEN> string
+    template<int32_t LITLEN> basic_string
     replace(const char(&from_literal)[LITLEN], char to) const {
         return stringlib_replace(
             from_literal, LITLEN,
-            &to, 1, INT32_MAX
+            &to, 1, INT64_MAX
         );
     }
-    template<int32_t LITLEN> string
+    template<int32_t LITLEN> basic_string
     replace(const char(&from_literal)[LITLEN], char32_t to) const {
         char buf[5];
         return stringlib_replace(
             from_literal, LITLEN,
-            buf, cp2utf8(buf, to), INT32_MAX
+            buf, cp2utf8(buf, to), INT64_MAX
         );
     }
     
-    template<typename T> enable_if_ptr<T, char, string> 
-    replace(const string& from, T&& to) const {
+    template<typename T> enable_if_ptr<T, char, basic_string> 
+    replace(const basic_string& from, T&& to) const {
         return stringlib_replace(
             from.data(), from.length(),
-            to, strlen(to), INT32_MAX
+            to, strlen(to), INT64_MAX
         );
     }
-    template<int32_t LITLEN> string
-    replace(const string& from, const char (&to_literal)[LITLEN]) const {
+    template<int32_t LITLEN> basic_string
+    replace(const basic_string& from, const char (&to_literal)[LITLEN]) const {
         return stringlib_replace(
             from.data(), from.length(),
-            to_literal, LITLEN, INT32_MAX
+            to_literal, LITLEN, INT64_MAX
         );
     }
-    string
-    replace(const string& from, const string& to) const {
+    basic_string
+    replace(const basic_string& from, const basic_string& to) const {
         return stringlib_replace(
             from.data(), from.length(),
-            to.data(), to.length(), INT32_MAX
+            to.data(), to.length(), INT64_MAX
         );
     }
-    string
-    replace(const string& from, char to) const {
+    basic_string
+    replace(const basic_string& from, char to) const {
         return stringlib_replace(
             from.data(), from.length(),
-            &to, 1, INT32_MAX
+            &to, 1, INT64_MAX
         );
     }
-    string
-    replace(const string& from, char32_t to) const {
+    basic_string
+    replace(const basic_string& from, char32_t to) const {
         char buf[5];
         return stringlib_replace(
             from.data(), from.length(),
-            buf, cp2utf8(buf, to), INT32_MAX
+            buf, cp2utf8(buf, to), INT64_MAX
         );
     }
 
-    template<typename T> enable_if_ptr<T, char, string> 
+    template<typename T> enable_if_ptr<T, char, basic_string> 
     replace(char from, T&& to) const {
         return stringlib_replace(
             &from, 1, 
-            to, strlen(to), INT32_MAX
+            to, strlen(to), INT64_MAX
         );
     }
-    template<int32_t LITLEN> string
+    template<int32_t LITLEN> basic_string
     replace(char from, const char (&to_literal)[LITLEN]) const {
         return stringlib_replace(
             &from, 1,
-            to_literal, LITLEN, INT32_MAX
+            to_literal, LITLEN, INT64_MAX
         );
     }
-    string
-    replace(char from, const string& to) const {
+    basic_string
+    replace(char from, const basic_string& to) const {
         return stringlib_replace(
             &from, 1, 
-            to.data(), to.length(), INT32_MAX
+            to.data(), to.length(), INT64_MAX
         );
     }
-    string
-    replace(char from, char to) const {
+    basic_string
+    replace(char from, char to) const& {
         return stringlib_replace_single_character_in_place(
-            from, to, INT32_MAX
+            from, to, INT64_MAX
         );
     }
-    string
+    basic_string
+    replace(char from, char to) && {
+        char* str = writableData();
+        if (!str) {
+            return replace(from, to);
+        }
+        size_type len = length();
+        for (size_type i = 0; i < len; i++) {
+            if (str[i] == from) {
+                str[i] = to;
+            }
+        }
+        return std::move(*this);
+    }
+    basic_string
     replace(char from, char32_t to) const {
         char buf[5];
         return stringlib_replace(
             &from, 1, 
-            buf, cp2utf8(buf, to), INT32_MAX
+            buf, cp2utf8(buf, to), INT64_MAX
         );
     }
 
-    template<typename T> enable_if_ptr<T, char, string> 
+    template<typename T> enable_if_ptr<T, char, basic_string> 
     replace(char32_t from, T&& to) const {
         char buf[5];
         return stringlib_replace(
             buf, cp2utf8(buf, from),
-            to, strlen(to), INT32_MAX
+            to, strlen(to), INT64_MAX
         );
     }
-    template<int32_t LITLEN> string
+    template<int32_t LITLEN> basic_string
     replace(char32_t from, const char (&to_literal)[LITLEN]) const {
         char buf[5];
         return stringlib_replace(
             buf, cp2utf8(buf, from),
-            to_literal, LITLEN, INT32_MAX
+            to_literal, LITLEN, INT64_MAX
         );
     }
-    string
-    replace(char32_t from, const string& to) const {
+    basic_string
+    replace(char32_t from, const basic_string& to) const {
         char buf[5];
         return stringlib_replace(
             buf, cp2utf8(buf, from),
-            to.data(), to.length(), INT32_MAX
+            to.data(), to.length(), INT64_MAX
         );
     }
-    string
+    basic_string
     replace(char32_t from, char to) const {
         char buf[5];
         return stringlib_replace(
             buf, cp2utf8(buf, from),
-            &to, 1, INT32_MAX
+            &to, 1, INT64_MAX
         );
     }
-    string
+    basic_string
     replace(char32_t from, char32_t to) const {
         char buf1[5];
         char buf2[5];
         return stringlib_replace(
             buf1, cp2utf8(buf1, from),
-            buf2, cp2utf8(buf2, to), INT32_MAX
+            buf2, cp2utf8(buf2, to), INT64_MAX
         );
     }
+/* replaceMany.cpp */
+    /* Every from->to replacement in one pass over the string: at each
+     * point the leftmost, then longest, from is replaced, and scanning
+     * resumes after it, so replacements never apply to their own output. */
+    basic_string replaceMany(const Replacer&) const;
+    basic_string replaceMany(const std::vector<std::pair<basic_string, basic_string>>&) const;
 /* misc.cpp */
-    string padLeft(uint32_t max_len, char) const;
-    string padRight(uint32_t max_len, char) const;
+    basic_string padLeft(size_type max_len, char) const&;
+    basic_string padLeft(size_type max_len, char) &&;
+    basic_string padRight(size_type max_len, char) const&;
+    basic_string padRight(size_type max_len, char) &&;
     int64_t parseInt();
     float parseFloat();
     double parseDouble();
     char* toCharArray() const;
     std::string toStl() const;
     std::vector<char> toVec() const;
-    friend std::ostream& operator<<(std::ostream&, const string&);
+    friend std::ostream& operator<<(std::ostream& stream, const basic_string& s) {
+        stream.write(s.data(), s.length());
+        return stream;
+    }
 private:
 /* toCase.cpp */
-    string caseMapUtf8(int mode) const;
+    basic_string caseMapUtf8(int mode) const;
 public:
-    string toUpperCase() const;
-    string toTitleCase() const;
-    string toLowerCase() const;
-    string capitalize() const;
+    basic_string toUpperCase() const&;
+    basic_string toUpperCase() &&;
+    basic_string toTitleCase() const;
+    basic_string toLowerCase() const&;
+    basic_string toLowerCase() &&;
+    basic_string capitalize() const;
 /* trim.cpp */
-    string trim() const;
-    string trimLeft() const;
-    string trimRight() const;
+    basic_string trim() const&;
+    basic_string trim() &&;
+    basic_string trimLeft() const&;
+    basic_string trimLeft() &&;
+    basic_string trimRight() const&;
+    basic_string trimRight() &&;
 /* valid.cpp */
     bool isUtf8() const;
-    string toUtf8() const;
+    basic_string toUtf8() const;
+};
+
+// A pending a + b + ...; see basic_string_plus.
+template<typename Traits, typename L, typename R>
+class basic_string_concat
+    : public basic_string_plus<Traits, basic_string_concat<Traits, L, R>> {
+    L left;
+    R right;
+public:
+    basic_string_concat(const L& left, const R& right)
+        : left(left), right(right) {}
+    uint64_t size() const {
+        return left.size() + right.size();
+    }
+    char* write(char* dst) const {
+        return right.write(left.write(dst));
+    }
+    typename basic_string<Traits>::size_type length() const {
+        return size();
+    }
+    operator basic_string<Traits>() const {
+        basic_string<Traits> res(
+            (typename basic_string<Traits>::ssize_type)size()
+        );
+        write(res.data());
+        return res;
+    }
+};
+
+/* builder.cpp */
+/* Builds a string in one growing buffer that nobody else can see,
+ * so appends never check a reference count, numbers are formatted
+ * straight into the buffer, and build() hands the buffer to the
+ * result instead of copying it. reserve() up front makes the whole
+ * build one allocation. writableTail(n) exposes room for n bytes
+ * at the end for an encoder to fill; commit(k) then keeps k <= n of
+ * them. A builder can be reused after build(). */
+template<typename Traits> class basic_string_builder : public string_base {
+public:
+    typedef typename Traits::size_type size_type;
+private:
+    // Owns the buffer once there is one; its length is only
+    // brought up to date by build().
+    basic_string<Traits> buf;
+    char* start;
+    char* tail;
+    char* end;
+    void grow(size_type more);
+public:
+    basic_string_builder()
+        : buf(), start(nullptr), tail(nullptr), end(nullptr) {}
+    explicit basic_string_builder(size_type cap)
+        : basic_string_builder() {
+        reserve(cap);
+    }
+    basic_string_builder(const basic_string_builder&) = delete;
+    basic_string_builder& operator=(const basic_string_builder&) = delete;
+    basic_string_builder(basic_string_builder&&);
+    basic_string_builder& operator=(basic_string_builder&&);
+
+    size_type length() const {
+        return tail - start;
+    }
+    size_type capacity() const {
+        return end - start;
+    }
+    void reserve(size_type cap);
+    char* writableTail(size_type n) {
+        if ((size_type)(end - tail) < n) {
+            grow(n);
+        }
+        return tail;
+    }
+    void commit(size_type n) {
+        tail += n;
+    }
+    void clear() {
+        tail = start;
+    }
+    basic_string<Traits> build();
+
+    basic_string_builder& append(const char* str, size_type len) {
+        memcpy(writableTail(len), str, len);
+        tail += len;
+        return *this;
+    }
+    template<typename T> enable_if_ptr<T, char, basic_string_builder&> append(T&& str) {
+        return append(str, strlen(str));
+    }
+    template<int32_t LITLEN> basic_string_builder& append(const char (&literal)[LITLEN]) {
+        return append(literal, LITLEN-1);
+    }
+    basic_string_builder& append(const basic_string<Traits>& s) {
+        return append(s.data(), s.length());
+    }
+    basic_string_builder& append(int64_t);
+    basic_string_builder& append(uint64_t);
+    basic_string_builder& append(int32_t val) {
+        return append((int64_t)val);
+    }
+    basic_string_builder& append(uint32_t val) {
+        return append((uint64_t)val);
+    }
+    basic_string_builder& append(int16_t val) {
+        return append((int64_t)val);
+    }
+    basic_string_builder& append(uint16_t val) {
+        return append((uint64_t)val);
+    }
+    basic_string_builder& append(int8_t val) {
+        return append((int64_t)val);
+    }
+    basic_string_builder& append(uint8_t val) {
+        return append((uint64_t)val);
+    }
+    basic_string_builder& append(double);
+    basic_string_builder& append(float val) {
+        return append((double)val);
+    }
+    basic_string_builder& append(char val) {
+        *writableTail(1) = val;
+        tail++;
+        return *this;
+    }
+    basic_string_builder& append(char32_t);
+    basic_string_builder& append(bool val) {
+        if (val) {
+            return append("true", 4);
+        } else {
+            return append("false", 5);
+        }
+    }
+};
+
+typedef basic_string<string_traits> string;
+typedef string local_string;
+typedef basic_string<string64_traits> string64;
+typedef basic_string<sso_string_traits<24>> sso24_string;
+typedef basic_string<sso_string_traits<32>> sso32_string;
+typedef basic_string_builder<string_traits> string_builder;
+typedef string_builder local_string_builder;
+typedef basic_string_builder<string64_traits> string64_builder;
+typedef basic_string_builder<sso_string_traits<24>> sso24_string_builder;
+typedef basic_string_builder<sso_string_traits<32>> sso32_string_builder;
+
+/* indexOf.cpp */
+/* A needle prepared once for searching many haystacks, such as the
+ * same few keys over millions of lines. indexOf() and countOf() redo
+ * the needle's setup on every call; a Finder does it in its
+ * constructor (for needles over SHORT_NEEDLE bytes, fastsearch's
+ * two-way factorization and shift table). Searching doesn't change a
+ * Finder, so one can be shared between threads. Haystacks may be any
+ * flavor, or bytes. Matches follow indexOf() and countOf(): an empty
+ * needle matches nowhere, and counted matches don't overlap. */
+class string_base::Finder {
+    string pattern;
+    int64_t cut, period, gap;
+    bool periodic;
+    uint8_t table[64];
+    const char* first(const char* hay, uint64_t len) const;
+public:
+    explicit Finder(const string& needle);
+    template<typename Traits> explicit Finder(const basic_string<Traits>& needle)
+        : Finder(string(needle)) {}
+    template<int32_t LITLEN> explicit Finder(const char (&literal)[LITLEN])
+        : Finder(string(literal)) {}
+    const string& needle() const {
+        return pattern;
+    }
+
+    // The first match at or after from, or -1.
+    int64_t find(const char* hay, uint64_t len, uint64_t from = 0) const;
+    template<typename Traits> int64_t find(const basic_string<Traits>& hay, uint64_t from = 0) const {
+        return find(hay.data(), hay.length(), from);
+    }
+    template<typename Traits> bool contains(const basic_string<Traits>& hay) const {
+        return find(hay.data(), hay.length()) >= 0;
+    }
+    uint64_t count(const char* hay, uint64_t len) const;
+    template<typename Traits> uint64_t count(const basic_string<Traits>& hay) const {
+        return count(hay.data(), hay.length());
+    }
+    // Where each match starts, in order. The second form reuses out's storage.
+    template<typename Traits> std::vector<uint64_t> findAll(const basic_string<Traits>& hay) const {
+        std::vector<uint64_t> out;
+        findAll(hay.data(), hay.length(), out);
+        return out;
+    }
+    template<typename Traits> void findAll(const basic_string<Traits>& hay, std::vector<uint64_t>& out) const {
+        findAll(hay.data(), hay.length(), out);
+    }
+    void findAll(const char* hay, uint64_t len, std::vector<uint64_t>& out) const;
 };
+// Finder's counterpart for lastIndexOf().
+class string_base::RFinder {
+    string pattern;
+    unsigned long mask;
+    int64_t skip;
+public:
+    explicit RFinder(const string& needle);
+    template<typename Traits> explicit RFinder(const basic_string<Traits>& needle)
+        : RFinder(string(needle)) {}
+    template<int32_t LITLEN> explicit RFinder(const char (&literal)[LITLEN])
+        : RFinder(string(literal)) {}
+    const string& needle() const {
+        return pattern;
+    }
+
+    // The last match that ends at or before end, or -1.
+    int64_t rfind(const char* hay, uint64_t end) const;
+    template<typename Traits> int64_t rfind(const basic_string<Traits>& hay) const {
+        return rfind(hay.data(), hay.length());
+    }
+    template<typename Traits> int64_t rfind(const basic_string<Traits>& hay, uint64_t end) const {
+        return rfind(hay.data(), end < hay.length() ? end : hay.length());
+    }
+    template<typename Traits> bool contains(const basic_string<Traits>& hay) const {
+        return rfind(hay.data(), hay.length()) >= 0;
+    }
+};
+
+/* indexOfAny.cpp */
+/* A set of needles compiled to be searched for together in one pass,
+ * rather than with one indexOf() each. Up to 64 needles are found
+ * with Teddy, a SIMD filter on their first bytes (where AVX2 is
+ * available), and larger sets with an Aho-Corasick automaton. Like
+ * Finder, searching doesn't change it, so threads can share one, and
+ * copies share the compiled tables. Empty needles match nowhere. */
+class string_base::MultiFinder {
+    struct Tables;
+    std::shared_ptr<const Tables> tables;
+    void build(const std::vector<string>&);
+public:
+    struct Match {
+        int64_t start; // -1 for no match
+        uint32_t needle; // index in the list the set was built from
+    };
+    explicit MultiFinder(const std::vector<string>& needles) {
+        build(needles);
+    }
+    template<typename Traits> explicit MultiFinder(const std::vector<basic_string<Traits>>& needles) {
+        build(std::vector<string>(needles.begin(), needles.end()));
+    }
+    MultiFinder(std::initializer_list<string> needles) {
+        build(needles);
+    }
+    size_t size() const;
+    const string& needle(size_t i) const;
+
+    // The leftmost match; of the needles that start there, the longest.
+    Match find(const char* hay, uint64_t len) const;
+    template<typename Traits> Match find(const basic_string<Traits>& hay) const {
+        return find(hay.data(), hay.length());
+    }
+    template<typename Traits> bool contains(const basic_string<Traits>& hay) const {
+        return find(hay.data(), hay.length()).start >= 0;
+    }
+    /* Every occurrence of every needle, overlapping ones included,
+     * ordered by start and then by needle. Reuses out's storage. */
+    void findAll(const char* hay, uint64_t len, std::vector<Match>& out) const;
+    template<typename Traits> void findAll(const basic_string<Traits>& hay, std::vector<Match>& out) const {
+        findAll(hay.data(), hay.length(), out);
+    }
+    template<typename Traits> std::vector<Match> findAll(const basic_string<Traits>& hay) const {
+        std::vector<Match> out;
+        findAll(hay.data(), hay.length(), out);
+        return out;
+    }
+    /* The matches find() reports one after another, each search starting
+     * where the last match ended: what replaceMany() replaces. */
+    void findSuccessive(const char* hay, uint64_t len, std::vector<Match>& out) const;
+    // How often each needle occurs, counted as countOf() does: without overlaps.
+    void countEach(const char* hay, uint64_t len, std::vector<uint64_t>& counts) const;
+    template<typename Traits> std::vector<uint64_t> countEach(const basic_string<Traits>& hay) const {
+        std::vector<uint64_t> counts;
+        countEach(hay.data(), hay.length(), counts);
+        return counts;
+    }
+};
+
+/* replaceMany.cpp */
+/* A from->to table compiled once for replaceMany(), on a MultiFinder
+ * of the froms. Where several pairs have the same from, the first one
+ * wins; empty froms are ignored. Shared like MultiFinder. */
+class string_base::Replacer {
+    MultiFinder froms;
+    std::vector<string> tos;
+    template<typename> friend class basic_string;
+    static std::vector<string> firsts(const std::vector<std::pair<string, string>>&);
+    static std::vector<string> seconds(const std::vector<std::pair<string, string>>&);
+public:
+    explicit Replacer(const std::vector<std::pair<string, string>>& pairs)
+        : froms(firsts(pairs)), tos(seconds(pairs)) {}
+    template<typename Traits> explicit Replacer(
+        const std::vector<std::pair<basic_string<Traits>, basic_string<Traits>>>& pairs)
+        : Replacer(std::vector<std::pair<string, string>>(pairs.begin(), pairs.end())) {}
+    Replacer(std::initializer_list<std::pair<string, string>> pairs)
+        : Replacer(std::vector<std::pair<string, string>>(pairs)) {}
+    size_t size() const {
+        return tos.size();
+    }
+    template<typename Traits> basic_string<Traits> apply(const basic_string<Traits>& s) const {
+        return s.replaceMany(*this);
+    }
+};
+
+extern template class basic_string<string_traits>;
+extern template class basic_string<string64_traits>;
+extern template class basic_string<sso_string_traits<24>>;
+extern template class basic_string<sso_string_traits<32>>;
+extern template class basic_string_builder<string_traits>;
+extern template class basic_string_builder<string64_traits>;
+extern template class basic_string_builder<sso_string_traits<24>>;
+extern template class basic_string_builder<sso_string_traits<32>>;
+
+/* cord.cpp */
+/* A cord is text kept as a balanced tree of shared string chunks,
+ * for documents built from many appends while other code holds
+ * copies of earlier versions. Appending, prepending, concatenating
+ * and substring are O(log n) and never copy existing text; a cord
+ * is flattened into one string the first time str(), data() or a
+ * search needs contiguous bytes, and that string is remembered.
+ * Like string, a cord holds up to 4 GB. */
+class cord {
+public:
+    typedef string::size_type size_type;
+    typedef string::ssize_type ssize_type;
+    struct Node;
+private:
+    Node* root;
+    explicit cord(Node*);
+    Node* flatten() const;
+    static char* write(const Node*, char*);
+public:
+    cord();
+    cord(const string&);
+    template<int32_t LITLEN> cord(const char (&literal)[LITLEN])
+        : cord(string(literal)) {}
+    template<typename T, string_base::enable_if_ptr<T, char> = true> cord(T&& str)
+        : cord(string(str)) {}
+    ~cord();
+
+    cord(const cord&);
+    cord& operator=(const cord&);
+    cord(cord&&);
+    cord& operator=(cord&&);
+
+    size_type length() const;
+    // O(log n) until the cord has been flattened.
+    char operator[](size_type i) const;
+    cord substring(size_type) const;
+    cord substring(size_type, size_type) const;
+    friend cord operator+(const cord&, const cord&);
+    void operator+=(const cord&);
+    void prepend(const cord&);
+
+    string str() const;
+    explicit operator string() const {
+        return str();
+    }
+    // length() bytes, valid while this cord is alive and unchanged.
+    const char* data() const;
+    friend bool operator==(const cord& a, const cord& b) {
+        return a.length() == b.length() && a.str() == b.str();
+    }
+    friend bool operator!=(const cord& a, const cord& b) {
+        return !(a == b);
+    }
+    friend std::ostream& operator<<(std::ostream& stream, const cord& c) {
+        return stream << c.str();
+    }
+
+    // Searches run on the flattened string.
+    template<typename T> ssize_type indexOf(T&& x) const {
+        return str().indexOf(std::forward<T>(x));
+    }
+    template<typename T> ssize_type lastIndexOf(T&& x) const {
+        return str().lastIndexOf(std::forward<T>(x));
+    }
+    template<typename T> size_type countOf(T&& x) const {
+        return str().countOf(std::forward<T>(x));
+    }
+    template<typename T> bool includes(T&& x) const {
+        return str().includes(std::forward<T>(x));
+    }
+    template<typename T> bool startsWith(T&& x) const {
+        return str().startsWith(std::forward<T>(x));
+    }
+    template<typename T> bool endsWith(T&& x) const {
+        return str().endsWith(std::forward<T>(x));
+    }
+};
+
+namespace std {
+    template<typename Traits> struct hash<::basic_string<Traits>> {
+        size_t operator()(const ::basic_string<Traits>& s) const {
+            return (size_t)s.hash64();
+        }
+    };
+}
+
+// Every file defining members of basic_string ends with this.
+#define INSTANTIATE_STRINGS \
+    template class basic_string<string_traits>; \
+    template class basic_string<string64_traits>; \
+    template class basic_string<sso_string_traits<24>>; \
+    template class basic_string<sso_string_traits<32>>;
 
 #endif
\ No newline at end of file
@@ -1,6 +1,4 @@
 #include "string.hpp"
-typedef uint32_t u32;
-typedef int32_t i32;
 
 #define UNI_ALGO_DISABLE_PROP
 #define UNI_ALGO_DISABLE_NORM
@@ -26,49 +24,95 @@ UNI_ALGO_IMPL_NAMESPACE_END
 #define UNI_ALGO_DLL
 #define UNI_ALGO_FORCE_C_ARRAYS
 #include "lib/uni_algo/impl/impl_case.h"
-string string::caseMapUtf8(int mode) const {
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::caseMapUtf8(int mode) const {
     const char* src = data();
-    u32 len = length();
-    string res((i32)(len * impl_x_case_map_utf8));
+    size_type len = length();
+    basic_string res((ssize_type)(len * impl_x_case_map_utf8));
     char* dst = res.data();
-    u32 dst_len = impl_case_map_utf8(
+    size_type dst_len = impl_case_map_utf8(
         src, src+len, 
         dst, mode
     );
     res.shrinkNonSubstringToFitLength(dst_len);
     return res;
 }
-string string::toUpperCase() const {
+/* ASCII text keeps its length under case mapping, so a temporary
+ * we may write is mapped where it is. Anything else goes through
+ * uni_algo into a new buffer. */
+static bool isAscii(const char* str, uint64_t len) {
+    for (uint64_t i = 0; i < len; i++) {
+        if (str[i] & 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+static void shiftRange(char* str, uint64_t len, char lo, char hi) {
+    for (uint64_t i = 0; i < len; i++) {
+        if (str[i] >= lo && str[i] <= hi) {
+            str[i] ^= 0x20;
+        }
+    }
+}
+
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::toUpperCase() const& {
     return caseMapUtf8(
         impl_case_map_mode_uppercase
     );
 }
-string string::toTitleCase() const {
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::toUpperCase() && {
+    size_type len = length();
+    char* str = isAscii(data(), len) ? writableData() : nullptr;
+    if (!str) {
+        return toUpperCase();
+    }
+    shiftRange(str, len, 'a', 'z');
+    return std::move(*this);
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::toTitleCase() const {
     return caseMapUtf8(
         impl_case_map_mode_titlecase
     );
 }
-string string::toLowerCase() const {
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::toLowerCase() const& {
     return caseMapUtf8(
         impl_case_map_mode_lowercase
     );
 }
-string string::capitalize() const {
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::toLowerCase() && {
+    size_type len = length();
+    char* str = isAscii(data(), len) ? writableData() : nullptr;
+    if (!str) {
+        return toLowerCase();
+    }
+    shiftRange(str, len, 'A', 'Z');
+    return std::move(*this);
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::capitalize() const {
     const char* str = data();
-    u32 len = length();
-    u32 stop = len < 5 ? len : 5;
-    u32 first_ascii = 0;
+    size_type len = length();
+    size_type stop = len < 5 ? len : 5;
+    size_type first_ascii = 0;
     while (first_ascii < stop 
     && (str[first_ascii] & 0x80)) {
         first_ascii++;
     }
     char buf[5 * impl_x_case_map_utf8];
-    u32 buf_len = impl_case_map_utf8(
+    size_type buf_len = impl_case_map_utf8(
         str, str+first_ascii,
         buf, impl_case_map_mode_uppercase
     );
-    return string(
+    return basic_string(
         buf, str+first_ascii,
         buf_len, len-first_ascii
     );
-}
\ No newline at end of file
+}
+
+INSTANTIATE_STRINGS
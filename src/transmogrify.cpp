@@ -2,6 +2,7 @@
 // accessed 12 Dec 2022
 
 #include <stdint.h>
+#include <limits>
 #include "string.hpp"
 
 #if STRINGLIB_IS_UNICODE
@@ -40,26 +41,29 @@ Return a copy where all tab characters are expanded using spaces.
 If tabsize is not given, a tab size of 8 characters is assumed.
 [clinic start generated code]*/
 
-typedef int32_t Py_ssize_t;
+/* Indices are 64-bit for every flavor; only the overflow checks
+ * depend on how long the result string may be. */
+typedef int64_t Py_ssize_t;
 #define self *this
 #define STRINGLIB_STR(s) ((s).data())
-#define STRINGLIB_LEN(s) ((s).length())
-#define PY_SSIZE_T_MAX INT32_MAX
-#define STRINGLIB_NEW(_ignored, uninit_len) string((int32_t)(uninit_len))
+#define STRINGLIB_LEN(s) ((Py_ssize_t)(s).length())
+#define PY_SSIZE_T_MAX ((Py_ssize_t)std::numeric_limits<ssize_type>::max())
+#define STRINGLIB_NEW(_ignored, uninit_len) basic_string((ssize_type)(uninit_len))
 
 #include <stdio.h>
 #define PyExc_OverflowError "PyExc_OverflowError"
 #define PyErr_SetString(err, str) (fprintf(stderr, "err: %s; msg: %s\n", (err), (str)), exit(1))
 #define assert(x) ((!(x)) ? (PyErr_SetString("in assert", "it failed"), 0) : 0)
 
-string 
-string::stringlib_expandtabs_impl(int tabsize) const
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_expandtabs_impl(int tabsize) const
 /*[clinic end generated code: output=069cb7fae72e4c2b input=3c6d3b12aa3ccbea]*/
 {
     const char *e, *p;
     char *q;
     Py_ssize_t i, j;
-    string u;
+    basic_string u;
 
     /* First pass: determine size of output string */
     i = j = 0;
@@ -120,10 +124,11 @@ string::stringlib_expandtabs_impl(int tabsize) const
     return "";
 }
 
-string
-string::pad(Py_ssize_t left, Py_ssize_t right, char fill) const
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::pad(Py_ssize_t left, Py_ssize_t right, char fill) const
 {
-    string u;
+    basic_string u;
 
     if (left < 0)
         left = 0;
@@ -269,7 +274,7 @@ stringlib_zfill_impl(string self, Py_ssize_t width)*/
 /* find and count characters and substrings */
 
 #define findchar(target, target_len, c)                         \
-  ((char *)memchr((const void *)(target), c, target_len))
+  ((char *)string_base::findByte((target), c, target_len))
 
 
 static Py_ssize_t
@@ -280,6 +285,8 @@ countchar(const char *target, Py_ssize_t target_len, char c,
     const char *start = target;
     const char *end = target + target_len;
 
+    if (maxcount >= target_len)
+        return string_base::countByte(target, c, target_len);
     while ((start = findchar(start, end - start, c)) != NULL) {
         count++;
         if (count >= maxcount)
@@ -293,8 +300,9 @@ countchar(const char *target, Py_ssize_t target_len, char c,
 /* Algorithms for different cases of string replacement */
 
 /* len(self)>=1, from="", len(to)>=1, maxcount>=1 */
-string 
-string::stringlib_replace_interleave(
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_interleave(
     const char *to_s, Py_ssize_t to_len,
                              Py_ssize_t maxcount) const
 {
@@ -302,7 +310,7 @@ string::stringlib_replace_interleave(
     char *result_s;
     Py_ssize_t self_len, result_len;
     Py_ssize_t count, i;
-    string result;
+    basic_string result;
 
     self_len = STRINGLIB_LEN(self);
 
@@ -326,9 +334,6 @@ string::stringlib_replace_interleave(
     }
     result_len = count * to_len + self_len;
     result = STRINGLIB_NEW(NULL, result_len);
-    if (result == NULL) {
-        return "";
-    }
 
     self_s = STRINGLIB_STR(self);
     result_s = STRINGLIB_STR(result);
@@ -364,15 +369,16 @@ string::stringlib_replace_interleave(
 
 /* Special case for deleting a single character */
 /* len(self)>=1, len(from)==1, to="", maxcount>=1 */
-string 
-string::stringlib_replace_delete_single_character(
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_delete_single_character(
     char from_c, Py_ssize_t maxcount) const
 {
     const char *self_s, *start, *next, *end;
     char *result_s;
     Py_ssize_t self_len, result_len;
     Py_ssize_t count;
-    string result;
+    basic_string result;
 
     self_len = STRINGLIB_LEN(self);
     self_s = STRINGLIB_STR(self);
@@ -386,9 +392,6 @@ string::stringlib_replace_delete_single_character(
     assert(result_len>=0);
 
     result = STRINGLIB_NEW(NULL, result_len);
-    if (result == NULL) {
-        return "";
-    }
     result_s = STRINGLIB_STR(result);
 
     start = self_s;
@@ -408,15 +411,16 @@ string::stringlib_replace_delete_single_character(
 
 /* len(self)>=1, len(from)>=2, to="", maxcount>=1 */
 
-string 
-string::stringlib_replace_delete_substring(const char *from_s, Py_ssize_t from_len,
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_delete_substring(const char *from_s, Py_ssize_t from_len,
                                    Py_ssize_t maxcount) const
 {
     const char *self_s, *start, *next, *end;
     char *result_s;
     Py_ssize_t self_len, result_len;
     Py_ssize_t count, offset;
-    string result;
+    basic_string result;
 
     self_len = STRINGLIB_LEN(self);
     self_s = STRINGLIB_STR(self);
@@ -434,9 +438,6 @@ string::stringlib_replace_delete_substring(const char *from_s, Py_ssize_t from_l
     assert (result_len>=0);
 
     result = STRINGLIB_NEW(NULL, result_len);
-    if (result == NULL) {
-        return "";
-    }
     result_s = STRINGLIB_STR(result);
 
     start = self_s;
@@ -459,14 +460,15 @@ string::stringlib_replace_delete_substring(const char *from_s, Py_ssize_t from_l
 }
 
 /* len(self)>=1, len(from)==len(to)==1, maxcount>=1 */
-string 
-string::stringlib_replace_single_character_in_place(char from_c, char to_c,
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_single_character_in_place(char from_c, char to_c,
                                             Py_ssize_t maxcount) const
 {
     const char *self_s, *end;
     char *result_s, *start, *next;
     Py_ssize_t self_len;
-    string result;
+    basic_string result;
 
     /* The result string will be the same size */
     self_s = STRINGLIB_STR(self);
@@ -481,9 +483,6 @@ string::stringlib_replace_single_character_in_place(char from_c, char to_c,
 
     /* Need to make a new bytes */
     result = STRINGLIB_NEW(NULL, self_len);
-    if (result == NULL) {
-        return "";
-    }
     result_s = STRINGLIB_STR(result);
     memcpy(result_s, self_s, self_len);
 
@@ -505,15 +504,16 @@ string::stringlib_replace_single_character_in_place(char from_c, char to_c,
 }
 
 /* len(self)>=1, len(from)==len(to)>=2, maxcount>=1 */
-string 
-string::stringlib_replace_substring_in_place(const char *from_s, Py_ssize_t from_len,
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_substring_in_place(const char *from_s, Py_ssize_t from_len,
                                      const char *to_s, Py_ssize_t to_len,
                                      Py_ssize_t maxcount) const
 {
     const char *self_s, *end;
     char *result_s, *start;
     Py_ssize_t self_len, offset;
-    string result;
+    basic_string result;
 
     /* The result bytes will be the same size */
 
@@ -530,9 +530,6 @@ string::stringlib_replace_substring_in_place(const char *from_s, Py_ssize_t from
 
     /* Need to make a new bytes */
     result = STRINGLIB_NEW(NULL, self_len);
-    if (result == NULL) {
-        return "";
-    }
     result_s = STRINGLIB_STR(result);
     memcpy(result_s, self_s, self_len);
 
@@ -556,8 +553,9 @@ string::stringlib_replace_substring_in_place(const char *from_s, Py_ssize_t from
 }
 
 /* len(self)>=1, len(from)==1, len(to)>=2, maxcount>=1 */
-string 
-string::stringlib_replace_single_character(char from_c,
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_single_character(char from_c,
                                    const char *to_s, Py_ssize_t to_len,
                                    Py_ssize_t maxcount) const
 {
@@ -565,7 +563,7 @@ string::stringlib_replace_single_character(char from_c,
     char *result_s;
     Py_ssize_t self_len, result_len;
     Py_ssize_t count;
-    string result;
+    basic_string result;
 
     self_s = STRINGLIB_STR(self);
     self_len = STRINGLIB_LEN(self);
@@ -586,9 +584,6 @@ string::stringlib_replace_single_character(char from_c,
     result_len = self_len + count * (to_len - 1);
 
     result = STRINGLIB_NEW(NULL, result_len);
-    if (result == NULL) {
-        return "";
-    }
     result_s = STRINGLIB_STR(result);
 
     start = self_s;
@@ -619,8 +614,9 @@ string::stringlib_replace_single_character(char from_c,
 }
 
 /* len(self)>=1, len(from)>=2, len(to)>=2, maxcount>=1 */
-string 
-string::stringlib_replace_substring(const char *from_s, Py_ssize_t from_len,
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace_substring(const char *from_s, Py_ssize_t from_len,
                             const char *to_s, Py_ssize_t to_len,
                             Py_ssize_t maxcount) const
 {
@@ -628,7 +624,7 @@ string::stringlib_replace_substring(const char *from_s, Py_ssize_t from_len,
     char *result_s;
     Py_ssize_t self_len, result_len;
     Py_ssize_t count, offset;
-    string result;
+    basic_string result;
 
     self_s = STRINGLIB_STR(self);
     self_len = STRINGLIB_LEN(self);
@@ -652,9 +648,6 @@ string::stringlib_replace_substring(const char *from_s, Py_ssize_t from_len,
     result_len = self_len + count * (to_len - from_len);
 
     result = STRINGLIB_NEW(NULL, result_len);
-    if (result == NULL) {
-        return "";
-    }
     result_s = STRINGLIB_STR(result);
 
     start = self_s;
@@ -687,8 +680,9 @@ string::stringlib_replace_substring(const char *from_s, Py_ssize_t from_len,
 }
 
 
-string 
-string::stringlib_replace(const char *from_s, Py_ssize_t from_len,
+template<typename Traits>
+basic_string<Traits>
+basic_string<Traits>::stringlib_replace(const char *from_s, Py_ssize_t from_len,
                   const char *to_s, Py_ssize_t to_len,
                   Py_ssize_t maxcount) const
 {
@@ -750,3 +744,6 @@ string::stringlib_replace(const char *from_s, Py_ssize_t from_len,
 }
 
 #undef findchar
+
+
+INSTANTIATE_STRINGS
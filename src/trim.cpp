@@ -1,6 +1,6 @@
 #include "string.hpp"
-typedef uint32_t u32;
-typedef int32_t i32;
+typedef uint64_t u64;
+typedef int64_t i64;
 typedef uint8_t u8;
 
 /* whitespace is 0x1680, 0x2000-0x200a, 0x2028, 
@@ -47,8 +47,8 @@ static inline bool isAsciiWhitespace(u8 ch) {
     return ch <= ' ' || ch == 0x85 || ch == 0xA0;
 }
 
-static u32 indexOfNonWhitespace(const char* str, u32 len) {
-    u32 i = 0;
+static u64 indexOfNonWhitespace(const char* str, u64 len) {
+    u64 i = 0;
     while (i+2 < len) {
         if (isAsciiWhitespace(str[i])) {
             i++;
@@ -69,8 +69,9 @@ static u32 indexOfNonWhitespace(const char* str, u32 len) {
     }
     return i;
 }
-static i32 indexOfNonWhitespaceRev(const char* str, u32 len) {
-    i32 i = len;
+static i64 indexOfNonWhitespaceRev(const char* str, u64 len) {
+    // str[len] is only a NUL for strings that end their buffer
+    i64 i = (i64)len - 1;
     while (i >= 2) {
         if (isAsciiWhitespace(str[i])) {
             i--;
@@ -92,32 +93,59 @@ static i32 indexOfNonWhitespaceRev(const char* str, u32 len) {
     return i;
 }
 
-string string::trimLeft() const {
-    u32 len = length();
-    u32 start = indexOfNonWhitespace(data(), len);
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::trimLeft() const& {
+    size_type len = length();
+    size_type start = indexOfNonWhitespace(data(), len);
     if (start == len) {
         return "";
     }
     return substring(start);
 }
-string string::trimRight() const {
-    u32 len = length();
-    i32 end = indexOfNonWhitespaceRev(data(), len);
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::trimRight() const& {
+    size_type len = length();
+    ssize_type end = indexOfNonWhitespaceRev(data(), len);
     if (end == -1) {
         return "";
     }
     return substring(0, end+1);
 }
-string string::trim() const {
-    u32 len = length();
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::trim() const& {
+    size_type len = length();
     const char* str = data();
-    u32 start = indexOfNonWhitespace(str, len);
+    size_type start = indexOfNonWhitespace(str, len);
     if (start == len) {
         return "";
     }
-    i32 end = indexOfNonWhitespaceRev(str, len);
+    ssize_type end = indexOfNonWhitespaceRev(str, len);
     if (end == -1) {
         return "";
     }
     return substring(start, end+1);
-}
\ No newline at end of file
+}
+
+/* Trimming already shares the buffer; on a temporary it also gives
+ * up our reference, so the result is the buffer's only owner and the
+ * next && call in a chain can write to it in place. */
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::trimLeft() && {
+    basic_string res = trimLeft();
+    *this = basic_string();
+    return res;
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::trimRight() && {
+    basic_string res = trimRight();
+    *this = basic_string();
+    return res;
+}
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::trim() && {
+    basic_string res = trim();
+    *this = basic_string();
+    return res;
+}
+
+INSTANTIATE_STRINGS
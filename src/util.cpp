@@ -2,7 +2,7 @@
 #include "lib/utf8/unchecked.h"
 #include "string.hpp"
 
-int string::cp2utf8(char* buf, char32_t cp) {
+int string_base::cp2utf8(char* buf, char32_t cp) {
     if (utf8::internal::is_code_point_valid(cp)) {
         char* endp = utf8::unchecked::append(cp, buf);
         return endp - buf;
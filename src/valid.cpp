@@ -3,10 +3,9 @@
 #include "string.hpp"
 
 typedef uint8_t u8;
-typedef uint32_t u32;
-typedef int32_t i32;
 
-bool string::isUtf8() const {
+template<typename Traits>
+bool basic_string<Traits>::isUtf8() const {
     const u8* start = (const u8*)data();
     const u8* end = start+length();
     return utf8::is_valid(start, end);
@@ -47,9 +46,10 @@ static u8* betterReplaceInvalid(const u8* start, const u8* end, u8* out) {
     }
     return out;
 }
-string string::toUtf8() const {
+template<typename Traits>
+basic_string<Traits> basic_string<Traits>::toUtf8() const {
     const u8* start = (const u8*)data();
-    u32 len = length();
+    size_type len = length();
     const u8* end = start+len;
     const u8* invalid = utf8::find_invalid(start, end);
     if (invalid == end) {
@@ -57,18 +57,18 @@ string string::toUtf8() const {
     }
     // if there are N invalid utf8 bytes, 
     // there could be N replacement characters of 3 bytes each.
-    string res((i32)(len * 3));
+    basic_string res((ssize_type)(len * 3));
     u8* res_start = (u8*)res.data();
     u8* res_ptr = res_start;
-    u32 valid_before_len = invalid-start;
-    printf("valid_before_len: %d\n", valid_before_len);
+    size_type valid_before_len = invalid-start;
     if (valid_before_len) {
         memcpy(res_ptr, start, valid_before_len);
         res_ptr += valid_before_len;
     }
     res_ptr = betterReplaceInvalid(invalid, end, res_ptr);
-    u32 res_len = res_ptr-res_start;
-    printf("res len %d\n", res_len);
+    size_type res_len = res_ptr-res_start;
     res.shrinkNonSubstringToFitLength(res_len);
     return res;
-}
\ No newline at end of file
+}
+
+INSTANTIATE_STRINGS